@@ -1,6 +1,9 @@
 -- Abyssal Storage - Core Logic
 AbyssalStorage = AbyssalStorage or {}
 AbyssalStorage.items = {} -- { [itemEntry] = count }
+AbyssalStorage.craftable = {} -- { [spellId] = maxCrafts } from the server, inventory + vault
+AbyssalStorage.itemNames = {} -- { [itemEntry] = name } from server searches, for items the client hasn't cached
+AbyssalStorage.SORT_CATEGORY, AbyssalStorage.SORT_NAME, AbyssalStorage.SORT_COUNT = 0, 1, 2
 AbyssalStorage.PREFIX = "ABYS"
 
 -- ============================================================================
@@ -20,8 +23,11 @@ timerFrame:SetScript("OnUpdate", function(self, elapsed)
         local t = activeTimers[i]
         t.remaining = t.remaining - elapsed
         if t.remaining <= 0 then
+            -- Order doesn't matter: swap in the last timer instead of shifting the rest
+            local n = #activeTimers
+            activeTimers[i] = activeTimers[n]
+            activeTimers[n] = nil
             t.callback()
-            table.remove(activeTimers, i)
         else
             i = i + 1
         end
@@ -57,20 +63,206 @@ end
 -- Server Communication
 -- ============================================================================
 
-function AbyssalStorage:SendCommand(cmd)
-    SendChatMessage("." .. cmd, "SAY")
+-- Requests are addon whispers to ourselves: "REQ:<id>:<op>;<op>;..."
+-- The server answers every op with ACK:<id>:<index>:<data> or ERR:<id>:<index>:<code>
+local nextRequestId = 1
+local pendingRequests = {} -- { [id] = { ops = {...}, remaining = N, callback = fn } }
+
+local ERROR_TEXT = {
+    DISABLED = "The vault is disabled on this server.",
+    BAD_REQUEST = "Malformed request.",
+    NOT_IN_VAULT = "Item not found in vault.",
+    INVALID_ITEM = "Invalid item.",
+    INVALID_SPELL = "Invalid spell.",
+    NOT_CRAFTABLE = "Spell has no reagents.",
+    MISSING_REAGENTS = "Not enough reagents.",
+    BAG_FULL = "Not enough bag space.",
+    NO_MAILBOX = "You must be at a mailbox.",
+    NOTHING_TO_DO = "Nothing to do.",
+}
+
+-- ops: list of op strings, e.g. { "W 2589 20", "W 2592 0" }
+-- callback(index, ok, data, op) is invoked once per op as replies arrive
+function AbyssalStorage:SendRequest(ops, callback)
+    local id = nextRequestId
+    nextRequestId = nextRequestId + 1
+    pendingRequests[id] = { ops = ops, remaining = #ops, callback = callback }
+    SendAddonMessage(self.PREFIX, "REQ:" .. id .. ":" .. table.concat(ops, ";"), "WHISPER", UnitName("player"))
+    return id
+end
+
+function AbyssalStorage:HandleReply(id, index, ok, data)
+    local req = pendingRequests[id]
+    if not req then return end
+
+    if req.callback then
+        req.callback(index + 1, ok, data, req.ops[index + 1])
+    elseif not ok then
+        self:HandleError(ERROR_TEXT[data] or data)
+    end
+
+    req.remaining = req.remaining - 1
+    if req.remaining <= 0 then
+        pendingRequests[id] = nil
+    end
+end
+
+local function ReportResult(okText)
+    return function(index, ok, data)
+        if ok then
+            if okText then
+                DEFAULT_CHAT_FRAME:AddMessage("|cff00ccffAbyssal Storage: " .. okText(tonumber(data)) .. "|r")
+            end
+        else
+            AbyssalStorage:HandleError(ERROR_TEXT[data] or data)
+        end
+    end
+end
+
+-- list: { { entry, count }, ... } — count 0 withdraws everything; batched into one request
+function AbyssalStorage:WithdrawMany(list)
+    local ops = {}
+    for i, item in ipairs(list) do
+        ops[i] = "W " .. item[1] .. " " .. (item[2] or 0)
+    end
+    self:SendRequest(ops, function(index, ok, data)
+        local entry = list[index][1]
+        if ok then
+            local _, link = GetItemInfo(entry)
+            DEFAULT_CHAT_FRAME:AddMessage("|cff00ccffAbyssal Storage: Withdrew " .. (link or ("Item #" .. entry)) .. " x" .. data .. ".|r")
+        else
+            AbyssalStorage:HandleError(ERROR_TEXT[data] or data)
+        end
+    end)
 end
 
 function AbyssalStorage:Withdraw(entry, count)
-    self:SendCommand("abs withdraw " .. entry .. " " .. (count or 0))
+    self:WithdrawMany({ { entry, count } })
 end
 
 function AbyssalStorage:Deposit()
-    self:SendCommand("abs deposit")
+    self:SendRequest({ "D" }, ReportResult(function(n) return "Deposited " .. n .. " item stacks." end))
 end
 
 function AbyssalStorage:RequestSync()
-    self:SendCommand("abs sync")
+    self:SendRequest({ "S" }, ReportResult(nil))
+end
+
+function AbyssalStorage:RequestCraftable(skillId)
+    wipe(self.craftable)
+    self:SendRequest({ "K " .. skillId }, ReportResult(nil))
+end
+
+function AbyssalStorage:Craft(spellId, count)
+    self:SendRequest({ "C " .. spellId .. " " .. count }, ReportResult(nil))
+end
+
+-- Rows of the PAGE/CATS reply being received; the op's ACK hands them to the callback
+local pageRows = {}
+
+-- PAGE, CATS and FIND rows don't carry the request id, so only one request that
+-- returns rows is in flight at a time; the rest wait here for its ACK or ERR
+local rowRequests = {}
+local rowRequestBusy = false
+
+local function SendNextRowRequest()
+    local req = table.remove(rowRequests, 1)
+    if not req then
+        rowRequestBusy = false
+        return
+    end
+
+    rowRequestBusy = true
+    AbyssalStorage:SendRequest({ req.op }, function(index, ok, data)
+        req.callback(index, ok, data)
+        SendNextRowRequest()
+    end)
+end
+
+local function SendRowRequest(op, callback)
+    rowRequests[#rowRequests + 1] = { op = op, callback = callback }
+    if not rowRequestBusy then
+        SendNextRowRequest()
+    end
+end
+
+-- callback(rows, total) with rows = { { entry, count }, ... }; class/subclass optional
+function AbyssalStorage:RequestPage(sort, offset, limit, itemClass, itemSubClass, callback)
+    local op = "P " .. sort .. " " .. offset .. " " .. limit
+    if itemClass then
+        op = op .. " " .. itemClass
+        if itemSubClass then
+            op = op .. " " .. itemSubClass
+        end
+    end
+    SendRowRequest(op, function(index, ok, data)
+        local rows = pageRows
+        pageRows = {}
+        if ok then
+            callback(rows, tonumber(data))
+        else
+            AbyssalStorage:HandleError(ERROR_TEXT[data] or data)
+        end
+    end)
+end
+
+-- callback(categories) with categories = { { class, subclass, entries }, ... }
+function AbyssalStorage:RequestCategories(callback)
+    SendRowRequest("G", function(index, ok, data)
+        local rows = pageRows
+        pageRows = {}
+        if ok then
+            callback(rows)
+        else
+            AbyssalStorage:HandleError(ERROR_TEXT[data] or data)
+        end
+    end)
+end
+
+function AbyssalStorage:HandlePageRows(payload)
+    if not payload then return end
+    for row in payload:gmatch("[^;]+") do
+        local fields = {}
+        for n in row:gmatch("%d+") do
+            fields[#fields + 1] = tonumber(n)
+        end
+        pageRows[#pageRows + 1] = fields
+    end
+end
+
+local searchRows = {}
+
+-- Server-side name search; finds items the client hasn't cached.
+-- callback(rows, total) with rows = { { entry, count, name }, ... }. Names are
+-- remembered in self.itemNames so uncached items can be shown and filtered.
+function AbyssalStorage:RequestSearch(text, limit, callback)
+    -- ';' separates request ops
+    text = text:gsub(";", " ")
+    SendRowRequest("F " .. limit .. " " .. text, function(index, ok, data)
+        local rows = searchRows
+        searchRows = {}
+        if ok then
+            callback(rows, tonumber(data))
+        else
+            AbyssalStorage:HandleError(ERROR_TEXT[data] or data)
+        end
+    end)
+end
+
+function AbyssalStorage:HandleSearchRows(payload)
+    if not payload then return end
+    for row in payload:gmatch("[^;]+") do
+        local entry, count, name = row:match("^(%d+),(%d+),(.*)")
+        if entry then
+            entry = tonumber(entry)
+            self.itemNames[entry] = name
+            searchRows[#searchRows + 1] = { entry, tonumber(count), name }
+        end
+    end
+end
+
+function AbyssalStorage:TakeMailToVault()
+    self:SendRequest({ "M" }, ReportResult(function(n) return "Moved " .. n .. " mail attachments to the vault." end))
 end
 
 -- ============================================================================
@@ -88,43 +280,118 @@ function AbyssalStorage:HandleMessage(msg)
 
     if cmd == "SYNC" then
         self:HandleSync(payload)
+    elseif cmd == "SYNCB" then
+        self:BeginSync()
+    elseif cmd == "SYNCE" then
+        self:EndSync()
     elseif cmd == "UPD" then
         self:HandleUpdate(payload)
     elseif cmd == "DEL" then
         self:HandleDelete(payload)
-    elseif cmd == "ERR" then
-        self:HandleError(payload)
+    elseif cmd == "CRAFT" then
+        self:HandleCraftable(payload)
+    elseif cmd == "PAGE" or cmd == "CATS" then
+        self:HandlePageRows(payload)
+    elseif cmd == "FIND" then
+        self:HandleSearchRows(payload)
+    elseif cmd == "ACK" or cmd == "ERR" then
+        local id, index, data = payload:match("^(%d+):(%d+):(.*)")
+        if id then
+            self:HandleReply(tonumber(id), tonumber(index), cmd == "ACK", data)
+        elseif cmd == "ERR" then
+            self:HandleError(payload)
+        end
     end
 end
 
-function AbyssalStorage:HandleSync(payload)
-    if not payload or payload == "" then
-        self.items = {}
-        if self.UpdateUI then self:UpdateUI() end
-        return
+-- ============================================================================
+-- Sync Ingestion
+-- ============================================================================
+
+-- A full sync is SYNCB, any number of "SYNC:entry,count;..." chunks, then
+-- SYNCE:<entries>. Chunks are only queued when they arrive. A frame script
+-- parses them for at most SYNC_FRAME_BUDGET_MS per frame, so a big vault at
+-- login doesn't hitch. The parsed table replaces self.items once SYNCE has
+-- arrived and the queue is empty, followed by a single UI refresh. UPD/DEL
+-- received meanwhile are newer than the sync and are applied on top.
+local SYNC_FRAME_BUDGET_MS = 4
+
+-- Parsed chunks are cleared, so the queue has holes below syncHead and # can't
+-- be trusted on it: syncHead is the next chunk to parse, syncTail the last queued
+local syncQueue = {}
+local syncHead = 1
+local syncTail = 0
+local syncItems -- table being filled, nil when no sync is in progress
+local syncOverrides = {} -- { [entry] = count } from UPD/DEL during the sync
+local syncEnded = false
+
+local ingestFrame = CreateFrame("Frame")
+ingestFrame:Hide()
+
+local function FinishSync()
+    for entry, count in pairs(syncOverrides) do
+        syncItems[entry] = count > 0 and count or nil
     end
 
-    -- Parse "entry1,count1;entry2,count2;..."
-    -- SYNC messages may arrive in multiple packets — merge instead of replace
-    -- We track sync state: first SYNC clears, subsequent ones merge
-    if not self._syncActive then
-        self.items = {}
-        self._syncActive = true
+    AbyssalStorage.items = syncItems
+    syncItems = nil
+    wipe(syncOverrides)
+    wipe(syncQueue)
+    syncHead = 1
+    syncTail = 0
+    syncEnded = false
+    AbyssalStorage._syncActive = false
+    ingestFrame:Hide()
+
+    if AbyssalStorage.OnSyncComplete then AbyssalStorage:OnSyncComplete() end
+end
+
+ingestFrame:SetScript("OnUpdate", function(self)
+    local started = debugprofilestop()
+    while syncHead <= syncTail and debugprofilestop() - started < SYNC_FRAME_BUDGET_MS do
+        for entry, count in syncQueue[syncHead]:gmatch("(%d+),(%d+)") do
+            syncItems[tonumber(entry)] = tonumber(count)
+        end
+        syncQueue[syncHead] = nil
+        syncHead = syncHead + 1
     end
 
-    for pair in payload:gmatch("[^;]+") do
-        local entry, count = pair:match("(%d+),(%d+)")
-        if entry and count then
-            self.items[tonumber(entry)] = tonumber(count)
+    if syncHead > syncTail then
+        if syncEnded then
+            FinishSync()
+        else
+            self:Hide() -- wait for more chunks
         end
     end
+end)
 
-    -- Debounce UI update for multi-packet syncs
-    AbyssalStorage.CancelTimers()
-    AbyssalStorage.SetTimer(0.1, function()
-        AbyssalStorage._syncActive = false
-        if AbyssalStorage.UpdateUI then AbyssalStorage:UpdateUI() end
-    end)
+function AbyssalStorage:BeginSync()
+    self.synced = true
+    self._syncActive = true
+    syncItems = {}
+    wipe(syncOverrides)
+    wipe(syncQueue)
+    syncHead = 1
+    syncTail = 0
+    syncEnded = false
+end
+
+function AbyssalStorage:HandleSync(payload)
+    -- A chunk without SYNCB (lost or out of order) still starts a sync
+    if not syncItems then
+        self:BeginSync()
+    end
+    if payload and payload ~= "" then
+        syncTail = syncTail + 1
+        syncQueue[syncTail] = payload
+        ingestFrame:Show()
+    end
+end
+
+function AbyssalStorage:EndSync()
+    if not syncItems then return end
+    syncEnded = true
+    ingestFrame:Show()
 end
 
 function AbyssalStorage:HandleUpdate(payload)
@@ -138,8 +405,12 @@ function AbyssalStorage:HandleUpdate(payload)
         else
             self.items[entry] = nil
         end
-        -- Skip UI refresh during multi-packet SYNC to avoid flashing incomplete data
-        if not self._syncActive and self.UpdateUI then self:UpdateUI() end
+        -- Mid-sync the UI waits for the sync; the change is reapplied after it
+        if self._syncActive then
+            syncOverrides[entry] = count
+        elseif self.OnItemChanged then
+            self:OnItemChanged(entry, count)
+        end
     end
 end
 
@@ -148,8 +419,24 @@ function AbyssalStorage:HandleDelete(payload)
     local entry = tonumber(payload)
     if entry then
         self.items[entry] = nil
-        if not self._syncActive and self.UpdateUI then self:UpdateUI() end
+        if self._syncActive then
+            syncOverrides[entry] = 0
+        elseif self.OnItemChanged then
+            self:OnItemChanged(entry, 0)
+        end
+    end
+end
+
+-- "spellId,maxCrafts;..." — may arrive in multiple packets, RequestCraftable clears
+function AbyssalStorage:HandleCraftable(payload)
+    if not payload then return end
+    for pair in payload:gmatch("[^;]+") do
+        local spellId, count = pair:match("(%d+),(%d+)")
+        if spellId and count then
+            self.craftable[tonumber(spellId)] = tonumber(count)
+        end
     end
+    if self.UpdateCraftableCounts then self:UpdateCraftableCounts() end
 end
 
 function AbyssalStorage:HandleError(payload)
@@ -197,6 +484,8 @@ SlashCmdList["ABYSSAL"] = function(msg)
         AbyssalStorage:Deposit()
     elseif msg == "sync" then
         AbyssalStorage:RequestSync()
+    elseif msg == "mail" then
+        AbyssalStorage:TakeMailToVault()
     else
         local cmd, rest = msg:match("^(%S+)%s*(.*)")
         if cmd == "withdraw" then
@@ -211,6 +500,7 @@ SlashCmdList["ABYSSAL"] = function(msg)
             DEFAULT_CHAT_FRAME:AddMessage("  /abs - Toggle storage window")
             DEFAULT_CHAT_FRAME:AddMessage("  /abs deposit - Deposit all trade goods")
             DEFAULT_CHAT_FRAME:AddMessage("  /abs sync - Re-sync from server")
+            DEFAULT_CHAT_FRAME:AddMessage("  /abs mail - Move mail attachments to the vault")
             DEFAULT_CHAT_FRAME:AddMessage("  /abs withdraw <id> [count] - Withdraw items")
         end
     end
@@ -10,28 +10,121 @@ local TITLE_HEIGHT = 24
 local SCROLL_WIDTH = 16
 
 -- ============================================================================
--- Sorted/Filtered Item List
+-- Sorted Index / Filtered View
 -- ============================================================================
 
-local displayList = {} -- { {entry=N, count=N, name="...", icon="..."}, ... }
-local searchFilter = ""
+-- sortedIndex holds one record per vault entry in name order, with the lowercase
+-- name cached. It is rebuilt only after a SYNC; UPD/DEL patch it in place with a
+-- binary-searched insert/remove. displayList is sortedIndex itself when there is
+-- no filter, otherwise the matching subset, narrowed from the previous result
+-- while the search text keeps growing.
+local sortedIndex = {} -- { {entry=N, count=N, name="...", lower="...", icon="...", uncached=bool}, ... }
+local records = {} -- { [entry] = record }
+local displayList = sortedIndex
+local searchFilter = "" -- lowercase
+local indexDirty = true
+local uncachedCount = 0
+
+local function FillRecord(rec)
+    local name, _, _, _, _, _, _, _, _, icon = GetItemInfo(rec.entry)
+    if name then
+        rec.name, rec.icon, rec.uncached = name, icon, nil
+    else
+        -- Item not in client cache yet: the name a server search returned, else the entry ID
+        local known = AbyssalStorage.itemNames[rec.entry]
+        rec.name, rec.icon, rec.uncached = known or ("Item #" .. rec.entry), "Interface\\Icons\\INV_Misc_QuestionMark", true
+        rec.named = known ~= nil
+        uncachedCount = uncachedCount + 1
+    end
+    rec.lower = rec.name:lower()
+end
 
-local function BuildDisplayList()
-    wipe(displayList)
-    for entry, count in pairs(AbyssalStorage.items) do
-        local name, _, _, _, _, _, _, _, _, icon = GetItemInfo(entry)
-        if name then
-            if searchFilter == "" or name:lower():find(searchFilter:lower(), 1, true) then
-                table.insert(displayList, { entry = entry, count = count, name = name, icon = icon })
-            end
+local function RecordLess(a, b)
+    if a.lower ~= b.lower then
+        return a.lower < b.lower
+    end
+    return a.entry < b.entry
+end
+
+-- First position in list whose record doesn't sort before rec
+local function LowerBound(list, rec)
+    local lo, hi = 1, #list + 1
+    while lo < hi do
+        local mid = math.floor((lo + hi) / 2)
+        if RecordLess(list[mid], rec) then
+            lo = mid + 1
         else
-            -- Item not in client cache yet, show entry ID
-            if searchFilter == "" then
-                table.insert(displayList, { entry = entry, count = count, name = "Item #" .. entry, icon = "Interface\\Icons\\INV_Misc_QuestionMark" })
+            hi = mid
+        end
+    end
+    return lo
+end
+
+local function InsertSorted(list, rec)
+    local pos = LowerBound(list, rec)
+    table.insert(list, pos, rec)
+    return pos
+end
+
+local function RemoveSorted(list, rec)
+    local pos = LowerBound(list, rec)
+    if list[pos] == rec then
+        table.remove(list, pos)
+        return pos
+    end
+end
+
+-- Uncached items only match once a server search has told us their name
+local function Matches(rec, filter)
+    return filter == "" or ((not rec.uncached or rec.named) and rec.lower:find(filter, 1, true) ~= nil)
+end
+
+local function ApplyFilter(filter)
+    if filter == "" then
+        displayList = sortedIndex
+    else
+        -- A longer search only ever matches a subset of the shorter one
+        local source = sortedIndex
+        if searchFilter ~= "" and filter:find(searchFilter, 1, true) then
+            source = displayList
+        end
+        local narrowed = {}
+        for _, rec in ipairs(source) do
+            if Matches(rec, filter) then
+                narrowed[#narrowed + 1] = rec
             end
         end
+        displayList = narrowed
+    end
+    searchFilter = filter
+end
+
+local function RebuildIndex()
+    wipe(sortedIndex)
+    wipe(records)
+    uncachedCount = 0
+    for entry, count in pairs(AbyssalStorage.items) do
+        local rec = { entry = entry, count = count }
+        FillRecord(rec)
+        records[entry] = rec
+        sortedIndex[#sortedIndex + 1] = rec
+    end
+    table.sort(sortedIndex, RecordLess)
+    indexDirty = false
+end
+
+-- Re-query names that weren't cached when their records were made
+local function ResolveUncached()
+    local previous = uncachedCount
+    uncachedCount = 0
+    for _, rec in ipairs(sortedIndex) do
+        if rec.uncached then
+            FillRecord(rec)
+        end
+    end
+    if uncachedCount ~= previous then
+        table.sort(sortedIndex, RecordLess)
     end
-    table.sort(displayList, function(a, b) return a.name < b.name end)
 end
 
 -- ============================================================================
@@ -91,8 +184,19 @@ searchBox:SetSize(frameWidth - FRAME_PADDING * 2 - 40, SEARCH_HEIGHT)
 searchBox:SetPoint("TOPLEFT", frame, "TOPLEFT", FRAME_PADDING + 20, -(FRAME_PADDING + TITLE_HEIGHT + 4))
 searchBox:SetAutoFocus(false)
 searchBox:SetScript("OnTextChanged", function(self)
-    searchFilter = self:GetText() or ""
-    AbyssalStorage:UpdateUI()
+    local filter = (self:GetText() or ""):lower()
+    if filter == searchFilter then return end
+    ApplyFilter(filter)
+    AbyssalStorage:RefreshView()
+
+    -- Names the client doesn't have come from the server, once typing pauses
+    if filter ~= "" and uncachedCount > 0 then
+        AbyssalStorage.SetTimer(0.3, function()
+            if searchFilter == filter then
+                AbyssalStorage:SearchUncached(filter)
+            end
+        end)
+    end
 end)
 searchBox:SetScript("OnEscapePressed", function(self)
     self:ClearFocus()
@@ -249,44 +353,44 @@ end
 -- Grid Update
 -- ============================================================================
 
-function AbyssalStorage:UpdateGrid()
+local function DrawCell(cell, data)
+    if data then
+        cell.icon:SetTexture(data.icon)
+        cell.countText:SetText(data.count > 1 and data.count or "")
+        cell.itemEntry = data.entry
+        cell.itemCount = data.count
+        cell:Show()
+    else
+        cell.icon:SetTexture(nil)
+        cell.countText:SetText("")
+        cell.itemEntry = nil
+        cell.itemCount = nil
+        cell:Hide()
+    end
+end
+
+-- Redraws the visible cells, or only those from list position firstIndex on
+function AbyssalStorage:UpdateGrid(firstIndex)
     local scrollOffset = math.floor(scrollBar:GetValue())
     local startIndex = scrollOffset * ITEMS_PER_ROW + 1
     local totalCells = ITEMS_PER_ROW * VISIBLE_ROWS
 
-    for i = 1, totalCells do
-        local cell = cells[i]
-        local dataIndex = startIndex + i - 1
-        local data = displayList[dataIndex]
-
-        if data then
-            cell.icon:SetTexture(data.icon)
-            cell.countText:SetText(data.count > 1 and data.count or "")
-            cell.itemEntry = data.entry
-            cell.itemCount = data.count
-            cell:Show()
-        else
-            cell.icon:SetTexture(nil)
-            cell.countText:SetText("")
-            cell.itemEntry = nil
-            cell.itemCount = nil
-            cell:Hide()
-        end
+    for i = math.max(1, (firstIndex or startIndex) - startIndex + 1), totalCells do
+        DrawCell(cells[i], displayList[startIndex + i - 1])
     end
 end
 
-function AbyssalStorage:UpdateUI()
-    if not AbyssalStorageFrame:IsShown() then return end
-
-    BuildDisplayList()
-
+-- Scroll range and item count for the current displayList, then the grid
+function AbyssalStorage:RefreshView(firstIndex)
     local totalRows = math.ceil(#displayList / ITEMS_PER_ROW)
     local maxScroll = math.max(0, totalRows - VISIBLE_ROWS)
     scrollBar:SetMinMaxValues(0, maxScroll)
 
     -- Clamp scroll position so it doesn't point beyond the display list
+    -- (SetValue fires OnValueChanged, which already redraws the grid)
     if scrollBar:GetValue() > maxScroll then
         scrollBar:SetValue(maxScroll)
+        firstIndex = nil
     end
 
     -- Item count display
@@ -296,7 +400,88 @@ function AbyssalStorage:UpdateUI()
     end
     frame.itemCountText:SetText(#displayList .. " items")
 
-    self:UpdateGrid()
+    self:UpdateGrid(firstIndex)
+end
+
+function AbyssalStorage:UpdateUI()
+    if not AbyssalStorageFrame:IsShown() then return end
+
+    if indexDirty then
+        RebuildIndex()
+    elseif uncachedCount > 0 then
+        ResolveUncached()
+    end
+
+    -- Filter from scratch: the index order may have changed under displayList
+    local filter = searchFilter
+    searchFilter = ""
+    ApplyFilter(filter)
+
+    self:RefreshView()
+end
+
+-- A SYNC replaced AbyssalStorage.items wholesale
+function AbyssalStorage:OnSyncComplete()
+    indexDirty = true
+    self:UpdateUI()
+end
+
+-- UPD/DEL for one entry: patch the index and redraw only what moved
+function AbyssalStorage:OnItemChanged(entry, count)
+    if indexDirty then return end -- rebuilt on next show
+
+    local rec = records[entry]
+    if rec and count > 0 then
+        rec.count = count
+        local pos = LowerBound(displayList, rec)
+        if displayList[pos] == rec and AbyssalStorageFrame:IsShown() then
+            self:UpdateGrid(pos)
+        end
+        return
+    end
+
+    local firstIndex
+    if rec then
+        records[entry] = nil
+        if rec.uncached then
+            uncachedCount = uncachedCount - 1
+        end
+        firstIndex = RemoveSorted(sortedIndex, rec)
+        if displayList ~= sortedIndex then
+            firstIndex = RemoveSorted(displayList, rec)
+        end
+    elseif count > 0 then
+        rec = { entry = entry, count = count }
+        FillRecord(rec)
+        records[entry] = rec
+        firstIndex = InsertSorted(sortedIndex, rec)
+        if displayList ~= sortedIndex then
+            firstIndex = Matches(rec, searchFilter) and InsertSorted(displayList, rec) or nil
+        end
+    end
+
+    if firstIndex and AbyssalStorageFrame:IsShown() then
+        self:RefreshView(firstIndex)
+    end
+end
+
+-- Ask the server for uncached items matching filter, then refilter with their names
+function AbyssalStorage:SearchUncached(filter)
+    self:RequestSearch(filter, 50, function(rows)
+        local renamed = false
+        for _, row in ipairs(rows) do
+            local rec = records[row[1]]
+            if rec and rec.uncached and not rec.named then
+                uncachedCount = uncachedCount - 1 -- FillRecord counts it again
+                FillRecord(rec)
+                renamed = true
+            end
+        end
+        if renamed then
+            table.sort(sortedIndex, RecordLess)
+            AbyssalStorage:UpdateUI()
+        end
+    end)
 end
 
 -- ============================================================================
@@ -318,6 +503,24 @@ hookFrame:SetScript("OnEvent", function(self, event)
     end
 end)
 
+-- ============================================================================
+-- Mailbox — "To Vault" button takes all eligible attachments server-side
+-- ============================================================================
+
+if InboxFrame then
+    local mailBtn = CreateFrame("Button", "AbyssalStorageMailButton", InboxFrame, "UIPanelButtonTemplate")
+    mailBtn:SetSize(80, 22)
+    mailBtn:SetPoint("BOTTOM", InboxFrame, "BOTTOM", -10, 104)
+    mailBtn:SetText("To Vault")
+    mailBtn:SetScript("OnClick", function()
+        AbyssalStorage:TakeMailToVault()
+        -- Refresh the inbox once the server has removed the attachments
+        AbyssalStorage.SetTimer(0.5, function()
+            CheckInbox()
+        end)
+    end)
+end
+
 -- ============================================================================
 -- TradeSkill Frame Hooks — Show vault reagents, enable Create button
 -- ============================================================================
@@ -373,12 +576,87 @@ local function GetMaxCraftsWithVault(id)
     return canCraftWithVault, maxCrafts
 end
 
+-- Skill line ID -> profession spell, used to map the localized TradeSkill title
+-- back to the skill line the server expects
+local PROFESSION_SPELLS = {
+    [171] = 2259,   -- Alchemy
+    [164] = 2018,   -- Blacksmithing
+    [185] = 2550,   -- Cooking
+    [333] = 7411,   -- Enchanting
+    [202] = 4036,   -- Engineering
+    [129] = 3273,   -- First Aid
+    [773] = 45357,  -- Inscription
+    [755] = 25229,  -- Jewelcrafting
+    [165] = 2108,   -- Leatherworking
+    [186] = 2575,   -- Mining
+    [197] = 3908,   -- Tailoring
+}
+
+local function GetTradeSkillLineId()
+    local skillName = GetTradeSkillLine()
+    if not skillName then return nil end
+    for skillId, spellId in pairs(PROFESSION_SPELLS) do
+        if GetSpellInfo(spellId) == skillName then
+            return skillId
+        end
+    end
+    return nil
+end
+
+local lastCraftableRequest = 0
+
+local function RequestCraftableCounts()
+    local skillId = GetTradeSkillLineId()
+    if not skillId then return end
+    -- TRADE_SKILL_UPDATE fires in bursts while crafting
+    if GetTime() - lastCraftableRequest < 1 then return end
+    lastCraftableRequest = GetTime()
+    AbyssalStorage:RequestCraftable(skillId)
+end
+
+-- Annotate visible recipe rows with the server-computed inventory + vault count
+function AbyssalStorage:UpdateCraftableCounts()
+    if not TradeSkillFrame or not TradeSkillFrame:IsVisible() then return end
+
+    for i = 1, TRADE_SKILLS_DISPLAYED do
+        local button = _G["TradeSkillSkill" .. i]
+        local id = button and button:IsShown() and button:GetID()
+        if id then
+            local skillName, skillType, numAvailable = GetTradeSkillInfo(id)
+            local spellId = skillType ~= "header" and GetTradeSkillSpellId(id)
+            local withVault = spellId and self.craftable[spellId]
+            if withVault and withVault > (numAvailable or 0) then
+                local countText = _G["TradeSkillSkill" .. i .. "Count"]
+                if countText then
+                    countText:SetText("[" .. withVault .. "]")
+                else
+                    button:SetText(" " .. skillName .. " [" .. withVault .. "]")
+                end
+            end
+        end
+    end
+end
+
 local tradeSkillHooked = false
 
 local function HookTradeSkill()
     if not TradeSkillFrame or tradeSkillHooked then return end
     tradeSkillHooked = true
 
+    -- Whole-profession craftable counts, refreshed from the server
+    local craftableFrame = CreateFrame("Frame")
+    craftableFrame:RegisterEvent("TRADE_SKILL_SHOW")
+    craftableFrame:RegisterEvent("TRADE_SKILL_UPDATE")
+    craftableFrame:SetScript("OnEvent", function(self, event)
+        if event == "TRADE_SKILL_SHOW" then
+            lastCraftableRequest = 0
+        end
+        RequestCraftableCounts()
+    end)
+    hooksecurefunc("TradeSkillFrame_Update", function()
+        AbyssalStorage:UpdateCraftableCounts()
+    end)
+
     -- Hook selection to update reagent counts, Create and Create All buttons
     hooksecurefunc("TradeSkillFrame_SetSelection", function(id)
         if not TradeSkillFrame:IsVisible() then return end
@@ -453,7 +731,7 @@ local function HookTradeSkill()
         end
     end)
 
-    -- Hook Create button to use .abs craft when vault materials are needed
+    -- Hook Create button to send a craft request when vault materials are needed
     if TradeSkillCreateButton then
         TradeSkillCreateButton:HookScript("PreClick", function(self)
             local id = TradeSkillFrame.selectedSkill
@@ -475,7 +753,7 @@ local function HookTradeSkill()
             local count = TradeSkillInputBox and TradeSkillInputBox:GetNumber() or 1
             if count < 1 then count = 1 end
 
-            AbyssalStorage:SendCommand("abs craft " .. spellId .. " " .. count)
+            AbyssalStorage:Craft(spellId, count)
         end)
     end
 
@@ -501,7 +779,7 @@ local function HookTradeSkill()
             local _, maxCrafts = GetMaxCraftsWithVault(id)
             if maxCrafts < 1 then return end
 
-            AbyssalStorage:SendCommand("abs craft " .. spellId .. " " .. maxCrafts)
+            AbyssalStorage:Craft(spellId, maxCrafts)
         end)
     end
 end
@@ -525,9 +803,21 @@ end
 -- ============================================================================
 
 AbyssalStorageFrame:SetScript("OnShow", function(self)
-    -- Trigger GetItemInfo for all items to populate client cache
-    for entry, _ in pairs(AbyssalStorage.items) do
-        GetItemInfo(entry)
+    -- Servers with lazy loading don't push a SYNC at login; fetch the vault on first open
+    if not AbyssalStorage.synced then
+        AbyssalStorage:RequestSync()
+    end
+    -- Trigger GetItemInfo for items missing from the client cache
+    if indexDirty then
+        for entry, _ in pairs(AbyssalStorage.items) do
+            GetItemInfo(entry)
+        end
+    else
+        for _, rec in ipairs(sortedIndex) do
+            if rec.uncached then
+                GetItemInfo(rec.entry)
+            end
+        end
     end
     -- Slight delay to let item info queries return
     AbyssalStorage.SetTimer(0.5, function()
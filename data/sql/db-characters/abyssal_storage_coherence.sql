@@ -0,0 +1,33 @@
+-- Per-row versions and change feed for running several worldservers against one characters DB.
+-- Safe to run more than once: columns are only added when missing.
+SET @sql = (SELECT IF(COUNT(*) = 0,
+  'ALTER TABLE `abyssal_storage` ADD COLUMN `version` INT UNSIGNED NOT NULL DEFAULT 0 AFTER `count`',
+  'DO 0')
+  FROM information_schema.COLUMNS
+  WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'abyssal_storage' AND COLUMN_NAME = 'version');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;
+
+CREATE TABLE IF NOT EXISTS `abyssal_storage_changes` (
+  `id` BIGINT UNSIGNED NOT NULL AUTO_INCREMENT,
+  `account_id` INT UNSIGNED NOT NULL,
+  `item_entry` INT UNSIGNED NOT NULL,
+  `version` INT UNSIGNED NOT NULL,
+  `origin` SMALLINT UNSIGNED NOT NULL,
+  `cas_token` BIGINT UNSIGNED NOT NULL DEFAULT 0,
+  `changed_at` TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,
+  PRIMARY KEY (`id`),
+  UNIQUE KEY `idx_row_version` (`account_id`, `item_entry`, `version`),
+  KEY `idx_changed_at` (`changed_at`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+-- Tables created before withdrawals tagged their change rows
+SET @sql = (SELECT IF(COUNT(*) = 0,
+  'ALTER TABLE `abyssal_storage_changes` ADD COLUMN `cas_token` BIGINT UNSIGNED NOT NULL DEFAULT 0 AFTER `origin`',
+  'DO 0')
+  FROM information_schema.COLUMNS
+  WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = 'abyssal_storage_changes' AND COLUMN_NAME = 'cas_token');
+PREPARE stmt FROM @sql;
+EXECUTE stmt;
+DEALLOCATE PREPARE stmt;
@@ -0,0 +1,11 @@
+-- Realm-wide SUM(count) per item, maintained incrementally by the worldserver
+CREATE TABLE IF NOT EXISTS `abyssal_storage_totals` (
+  `item_entry` INT UNSIGNED NOT NULL,
+  `total` BIGINT NOT NULL DEFAULT 0,
+  PRIMARY KEY (`item_entry`)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+-- Seed from existing vaults; later changes arrive as deltas
+DELETE FROM `abyssal_storage_totals`;
+INSERT INTO `abyssal_storage_totals` (`item_entry`, `total`)
+  SELECT `item_entry`, SUM(`count`) FROM `abyssal_storage` WHERE `count` > 0 GROUP BY `item_entry`;
@@ -1,5 +1,8 @@
 #include "AbyssalStorage.h"
+#include "Bag.h"
 #include "DatabaseEnv.h"
+#include "GameTime.h"
+#include "Item.h"
 #include "ItemTemplate.h"
 #include "Player.h"
 #include "WorldPacket.h"
@@ -8,6 +11,8 @@
 #include "ObjectMgr.h"
 #include "QuestDef.h"
 #include "Log.h"
+#include "StringFormat.h"
+#include <limits>
 
 AbyssalPlayerData* GetAbyssalData(Player* player)
 {
@@ -16,6 +21,126 @@ AbyssalPlayerData* GetAbyssalData(Player* player)
     return player->CustomData.GetDefault<AbyssalPlayerData>("AbyssalData");
 }
 
+// Free backpack + bag slots, same slots Player::CanStoreNewItem fills
+static uint32 CountFreeSlots(Player* player)
+{
+    uint32 freeSlots = 0;
+    for (uint8 slot = INVENTORY_SLOT_ITEM_START; slot < INVENTORY_SLOT_ITEM_END; ++slot)
+    {
+        if (!player->GetItemByPos(INVENTORY_SLOT_BAG_0, slot))
+            freeSlots++;
+    }
+    for (uint8 bag = INVENTORY_SLOT_BAG_START; bag < INVENTORY_SLOT_BAG_END; ++bag)
+    {
+        if (Bag* pBag = player->GetBagByPos(bag))
+        {
+            for (uint8 slot = 0; slot < pBag->GetBagSize(); ++slot)
+            {
+                if (!pBag->GetItemByPos(slot))
+                    freeSlots++;
+            }
+        }
+    }
+    return freeSlots;
+}
+
+// Walks the same slots as Player::GetItemCount (equipment, backpack, keyring,
+// currency, bag contents) in a single pass
+void AbyssalInventoryIndex::Rebuild(Player* player)
+{
+    for (auto& [entry, count] : _counts)
+        count = 0;
+    _freeSlots = 0;
+
+    auto addItem = [this](Item* item)
+    {
+        if (item)
+            _counts[item->GetEntry()] += item->GetCount();
+    };
+
+    for (uint8 slot = EQUIPMENT_SLOT_START; slot < INVENTORY_SLOT_ITEM_END; ++slot)
+    {
+        Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, slot);
+        addItem(item);
+        if (!item && slot >= INVENTORY_SLOT_ITEM_START)
+            _freeSlots++;
+    }
+
+    for (uint8 slot = KEYRING_SLOT_START; slot < CURRENCYTOKEN_SLOT_END; ++slot)
+        addItem(player->GetItemByPos(INVENTORY_SLOT_BAG_0, slot));
+
+    for (uint8 bag = INVENTORY_SLOT_BAG_START; bag < INVENTORY_SLOT_BAG_END; ++bag)
+    {
+        if (Bag* pBag = player->GetBagByPos(bag))
+        {
+            for (uint8 slot = 0; slot < pBag->GetBagSize(); ++slot)
+            {
+                Item* item = pBag->GetItemByPos(slot);
+                addItem(item);
+                if (!item)
+                    _freeSlots++;
+            }
+        }
+    }
+
+    _valid = true;
+    _freeSlotsValid = true;
+}
+
+uint32 AbyssalInventoryIndex::GetItemCount(Player* player, uint32 itemEntry)
+{
+    if (!_valid)
+        Rebuild(player);
+
+    auto itr = _counts.find(itemEntry);
+    uint32 count = itr != _counts.end() ? itr->second : 0;
+
+#ifndef NDEBUG
+    uint32 actual = player->GetItemCount(itemEntry);
+    if (actual != count)
+        LOG_ERROR("module", "AbyssalStorage: inventory index drift for player {} item {}: index {}, actual {}",
+            player->GetName(), itemEntry, count, actual);
+#endif
+
+    return count;
+}
+
+uint32 AbyssalInventoryIndex::GetFreeSlots(Player* player)
+{
+    if (!_valid || !_freeSlotsValid)
+        Rebuild(player);
+
+#ifndef NDEBUG
+    uint32 actual = CountFreeSlots(player);
+    if (actual != _freeSlots)
+        LOG_ERROR("module", "AbyssalStorage: free slot index drift for player {}: index {}, actual {}",
+            player->GetName(), _freeSlots, actual);
+#endif
+
+    return _freeSlots;
+}
+
+void AbyssalInventoryIndex::OnStored(uint32 itemEntry, uint32 count)
+{
+    if (!_valid)
+        return;
+
+    _counts[itemEntry] += count;
+    _freeSlotsValid = false; // may have merged into an existing stack or taken new slots
+}
+
+void AbyssalInventoryIndex::OnDestroyed(uint32 itemEntry, uint32 count)
+{
+    if (!_valid)
+        return;
+
+    auto itr = _counts.find(itemEntry);
+    if (itr != _counts.end())
+        itr->second -= std::min(itr->second, count);
+
+    _freeSlotsValid = false;
+}
+
 AbyssalStorageMgr* AbyssalStorageMgr::instance()
 {
     static AbyssalStorageMgr instance;
@@ -30,28 +155,74 @@ void AbyssalStorageMgr::LoadAccountData(uint32 accountId)
             return; // already loaded
     }
 
-    QueryResult result = CharacterDatabase.Query("SELECT item_entry, count FROM abyssal_storage WHERE account_id = {}", accountId);
+    if (IsReplayAccount(accountId))
+    {
+        std::lock_guard<std::mutex> lock(_storageMutex);
+        _storage[accountId];
+        return;
+    }
+
+    InstallAccountData(accountId, CharacterDatabase.Query(GetAccountLoadQuery(accountId)));
+}
 
-    std::unordered_map<uint32, uint32> items;
+std::string AbyssalStorageMgr::GetAccountLoadQuery(uint32 accountId) const
+{
+    // Entry list only in lazy mode; rows are fetched as they're needed (AbyssalStorageResidency.cpp)
+    if (_lazyLoad)
+        return Acore::StringFormat("SELECT item_entry FROM abyssal_storage WHERE account_id = {} AND count > 0", accountId);
+
+    // Coherent withdrawals leave emptied rows behind to keep their version; they aren't cached
+    return Acore::StringFormat("SELECT item_entry, count, version FROM abyssal_storage WHERE account_id = {} AND count > 0", accountId);
+}
+
+void AbyssalStorageMgr::InstallAccountData(uint32 accountId, QueryResult result)
+{
+    if (_lazyLoad)
+    {
+        AbyssalResidency residency;
+        if (result)
+        {
+            do
+            {
+                residency.known.insert(result->Fetch()[0].Get<uint32>());
+            } while (result->NextRow());
+        }
+        residency.complete = residency.known.empty();
+
+        std::lock_guard<std::mutex> lock(_storageMutex);
+        if (!_storage.emplace(accountId, AbyssalVault()).second)
+            return; // loaded while the query ran; that copy may already have writes
+        _residency[accountId] = std::move(residency);
+        _browseIndex.erase(accountId);
+        InvalidateSyncCache(accountId);
+        return;
+    }
+
+    AbyssalVault items;
     if (result)
     {
         do
         {
             Field* fields = result->Fetch();
             uint32 itemEntry = fields[0].Get<uint32>();
-            uint32 count = fields[1].Get<uint32>();
-            items[itemEntry] = count;
+            items[itemEntry] = { fields[1].Get<uint32>(), fields[2].Get<uint32>() };
         } while (result->NextRow());
     }
 
     std::lock_guard<std::mutex> lock(_storageMutex);
-    _storage[accountId] = std::move(items);
+    if (!_storage.emplace(accountId, std::move(items)).second)
+        return;
+    _browseIndex.erase(accountId);
+    InvalidateSyncCache(accountId);
 }
 
 void AbyssalStorageMgr::UnloadAccountData(uint32 accountId)
 {
     std::lock_guard<std::mutex> lock(_storageMutex);
     _storage.erase(accountId);
+    _residency.erase(accountId);
+    _browseIndex.erase(accountId);
+    InvalidateSyncCache(accountId);
 }
 
 bool AbyssalStorageMgr::IsAccountLoaded(uint32 accountId)
@@ -60,19 +231,62 @@ bool AbyssalStorageMgr::IsAccountLoaded(uint32 accountId)
     return _storage.find(accountId) != _storage.end();
 }
 
-void AbyssalStorageMgr::DepositItem(uint32 accountId, uint32 itemEntry, uint32 count)
+uint32 AbyssalStorageMgr::DepositItem(uint32 accountId, uint32 itemEntry, uint32 count)
 {
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    uint32 stored = DepositItem(accountId, itemEntry, count, trans);
+    if (stored)
+        CommitVaultTransaction(trans);
+    return stored;
+}
+
+uint32 AbyssalStorageMgr::DepositItem(uint32 accountId, uint32 itemEntry, uint32 count, CharacterDatabaseTransaction trans)
+{
+    // The cached count must be the real one before a delta is added to it
+    EnsureResident(accountId, { &itemEntry, 1 });
+
+    uint32 stored = 0;
     {
         std::lock_guard<std::mutex> lock(_storageMutex);
-        _storage[accountId][itemEntry] += count;
+        AbyssalVaultEntry& row = _storage[accountId][itemEntry];
+        if (!row.count)
+            SetEntryPresent(accountId, itemEntry, true);
+        // Counts saturate rather than wrap; the DB update below does the same
+        stored = std::min(count, std::numeric_limits<uint32>::max() - row.count);
+        row.count += stored;
+        InvalidateSyncCache(accountId);
+        row.lastUsed = uint32(GameTime::GetGameTime().count());
     }
 
-    CharacterDatabase.Execute("INSERT INTO abyssal_storage (account_id, item_entry, count) VALUES ({}, {}, {}) "
-        "ON DUPLICATE KEY UPDATE count = count + {}", accountId, itemEntry, count, count);
+    if (stored != count)
+        LOG_DEBUG("module", "AbyssalStorage: account {} item {} is at the count limit, {} of {} deposited", accountId, itemEntry, stored, count);
+
+    if (!stored || IsReplayAccount(accountId))
+        return stored;
+
+    // Deltas commute, so deposits never need a compare-and-set
+    trans->Append("INSERT INTO abyssal_storage (account_id, item_entry, count, version) VALUES ({}, {}, {}, 1) "
+        "ON DUPLICATE KEY UPDATE count = LEAST(count + {}, 4294967295), version = version + 1", accountId, itemEntry, stored, stored);
+
+    if (_coherent)
+        AppendChangeLog(trans, accountId, itemEntry);
+
+    AddRealmDelta(itemEntry, stored);
+    return stored;
+}
+
+uint32 AbyssalStorageMgr::GetVaultRoom(uint32 accountId, uint32 itemEntry)
+{
+    return std::numeric_limits<uint32>::max() - GetItemCount(accountId, itemEntry);
 }
 
 bool AbyssalStorageMgr::WithdrawItem(uint32 accountId, uint32 itemEntry, uint32 count)
 {
+    if (_coherent && !IsReplayAccount(accountId))
+        return WithdrawItemCoherent(accountId, itemEntry, count);
+
+    EnsureResident(accountId, { &itemEntry, 1 });
+
     std::lock_guard<std::mutex> lock(_storageMutex);
 
     auto accIt = _storage.find(accountId);
@@ -80,27 +294,36 @@ bool AbyssalStorageMgr::WithdrawItem(uint32 accountId, uint32 itemEntry, uint32
         return false;
 
     auto itemIt = accIt->second.find(itemEntry);
-    if (itemIt == accIt->second.end() || itemIt->second < count)
+    if (itemIt == accIt->second.end() || itemIt->second.count < count)
         return false;
 
-    itemIt->second -= count;
+    itemIt->second.count -= count;
+    InvalidateSyncCache(accountId);
 
-    if (itemIt->second == 0)
+    if (itemIt->second.count == 0)
     {
         accIt->second.erase(itemIt);
-        CharacterDatabase.Execute("DELETE FROM abyssal_storage WHERE account_id = {} AND item_entry = {}", accountId, itemEntry);
-    }
-    else
-    {
-        CharacterDatabase.Execute("UPDATE abyssal_storage SET count = {} WHERE account_id = {} AND item_entry = {}",
-            itemIt->second, accountId, itemEntry);
+        SetEntryPresent(accountId, itemEntry, false);
     }
 
+    if (IsReplayAccount(accountId))
+        return true;
+
+    // Relative update, guarded so the row can never go negative
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    trans->Append("UPDATE abyssal_storage SET count = count - {}, version = version + 1 "
+        "WHERE account_id = {} AND item_entry = {} AND count >= {}", count, accountId, itemEntry, count);
+    trans->Append("DELETE FROM abyssal_storage WHERE account_id = {} AND item_entry = {} AND count = 0", accountId, itemEntry);
+    CharacterDatabase.CommitTransaction(trans);
+
+    AddRealmDelta(itemEntry, -int64(count));
     return true;
 }
 
 uint32 AbyssalStorageMgr::GetItemCount(uint32 accountId, uint32 itemEntry)
 {
+    EnsureResident(accountId, { &itemEntry, 1 });
+
     std::lock_guard<std::mutex> lock(_storageMutex);
 
     auto accIt = _storage.find(accountId);
@@ -111,18 +334,25 @@ uint32 AbyssalStorageMgr::GetItemCount(uint32 accountId, uint32 itemEntry)
     if (itemIt == accIt->second.end())
         return 0;
 
-    return itemIt->second;
+    itemIt->second.lastUsed = uint32(GameTime::GetGameTime().count());
+    return itemIt->second.count;
 }
 
 std::unordered_map<uint32, uint32> AbyssalStorageMgr::GetAllItems(uint32 accountId)
 {
+    EnsureFullyLoaded(accountId);
+
     std::lock_guard<std::mutex> lock(_storageMutex);
 
     auto accIt = _storage.find(accountId);
     if (accIt == _storage.end())
         return {};
 
-    return accIt->second;
+    std::unordered_map<uint32, uint32> items;
+    items.reserve(accIt->second.size());
+    for (auto const& [entry, vaultEntry] : accIt->second)
+        items.emplace(entry, vaultEntry.count);
+    return items;
 }
 
 uint32 AbyssalStorageMgr::GetQuestReservedCount(Player* player, uint32 itemId)
@@ -156,7 +386,7 @@ uint32 AbyssalStorageMgr::GetQuestReservedCount(Player* player, uint32 itemId)
 bool AbyssalStorageMgr::IsItemRequiredByActiveQuest(Player* player, uint32 itemId)
 {
     uint32 reserved = GetQuestReservedCount(player, itemId);
-    return reserved > 0 && player->GetItemCount(itemId) <= reserved;
+    return reserved > 0 && GetAbyssalData(player)->inventory.GetItemCount(player, itemId) <= reserved;
 }
 
 bool AbyssalStorageMgr::ShouldAutoStore(Player* player, ItemTemplate const* itemTemplate)
@@ -177,7 +407,7 @@ bool AbyssalStorageMgr::ShouldAutoStore(Player* player, ItemTemplate const* item
 //   arg1 (prefix) = everything before first \t
 //   arg2 (body)   = everything after first \t
 // Client fires CHAT_MSG_ADDON event.
-static void SendOnePacket(Player* player, std::string const& msg)
+static void SendOnePacket(Player* player, std::string_view msg)
 {
     WorldPacket data;
     std::size_t len = msg.length();
@@ -193,24 +423,27 @@ static void SendOnePacket(Player* player, std::string const& msg)
     player->GetSession()->SendPacket(&data);
 }
 
-void AbyssalStorageMgr::SendAddonMessage(Player* player, std::string const& message)
+// Splits message into packet bodies (each with the "ABYS\t" prefix) that fit the
+// client's limit. Long payloads are split at ';' and every piece repeats the "CMD:" head.
+static std::vector<std::string> SplitAddonMessage(std::string const& message)
 {
     // Prefix with "ABYS\t" so client receives arg1="ABYS", arg2=message
     const size_t MAX_MSG_LEN = 240; // leave room for prefix
+    std::vector<std::string> packets;
     std::string fullMsg = "ABYS\t" + message;
 
     if (fullMsg.length() <= MAX_MSG_LEN)
     {
-        SendOnePacket(player, fullMsg);
-        return;
+        packets.push_back(std::move(fullMsg));
+        return packets;
     }
 
     // For SYNC messages, split by semicolons to create valid chunks
     size_t prefixEnd = message.find(':');
     if (prefixEnd == std::string::npos)
     {
-        SendOnePacket(player, ("ABYS\t" + message.substr(0, MAX_MSG_LEN - 5)));
-        return;
+        packets.push_back("ABYS\t" + message.substr(0, MAX_MSG_LEN - 5));
+        return packets;
     }
     prefixEnd++;
 
@@ -236,7 +469,7 @@ void AbyssalStorageMgr::SendAddonMessage(Player* player, std::string const& mess
 
         if (chunk.length() > prefix.length() && chunk.length() + 1 + entry.length() + 5 > MAX_MSG_LEN)
         {
-            SendOnePacket(player, "ABYS\t" + chunk);
+            packets.push_back("ABYS\t" + chunk);
             chunk = prefix;
         }
 
@@ -246,41 +479,100 @@ void AbyssalStorageMgr::SendAddonMessage(Player* player, std::string const& mess
     }
 
     if (chunk.length() > prefix.length())
-        SendOnePacket(player, "ABYS\t" + chunk);
+        packets.push_back("ABYS\t" + chunk);
+
+    return packets;
+}
+
+void AbyssalStorageMgr::SendAddonMessage(Player* player, std::string const& message)
+{
+    for (std::string const& packet : SplitAddonMessage(message))
+        SendOnePacket(player, packet);
 }
 
+// A SYNC is encoded once and the packet bodies kept until the vault changes, so
+// repeat syncs of an unchanged vault only replay them
 void AbyssalStorageMgr::SendFullSync(Player* player)
 {
     uint32 accountId = player->GetSession()->GetAccountId();
-    auto items = GetAllItems(accountId);
 
-    if (items.empty())
+    std::shared_ptr<std::vector<std::string> const> packets;
     {
-        SendAddonMessage(player, "SYNC:");
-        return;
+        std::lock_guard<std::mutex> lock(_storageMutex);
+        auto itr = _syncCache.find(accountId);
+        if (itr != _syncCache.end())
+        {
+            packets = itr->second;
+            ++_syncCacheHits;
+        }
     }
 
-    std::string msg = "SYNC:";
-    bool first = true;
-    for (auto const& pair : items)
+    if (!packets)
     {
-        if (!first)
-            msg += ";";
-        msg += std::to_string(pair.first) + "," + std::to_string(pair.second);
-        first = false;
+        EnsureFullyLoaded(accountId);
+
+        // Encoded under the lock, so no write can land between reading the vault and caching
+        std::lock_guard<std::mutex> lock(_storageMutex);
+
+        std::vector<std::string> encoded;
+        auto accIt = _storage.find(accountId);
+        std::size_t entries = accIt != _storage.end() ? accIt->second.size() : 0;
+
+        // SYNCB / SYNCE:<entries> bracket the chunks so the addon knows when the sync is complete
+        encoded.emplace_back("ABYS\tSYNCB:");
+        if (entries)
+        {
+            std::string msg = "SYNC:";
+            bool first = true;
+            for (auto const& [itemEntry, row] : accIt->second)
+            {
+                if (!first)
+                    msg += ";";
+                msg += std::to_string(itemEntry) + "," + std::to_string(row.count);
+                first = false;
+            }
+
+            std::vector<std::string> chunks = SplitAddonMessage(msg);
+            encoded.insert(encoded.end(), std::make_move_iterator(chunks.begin()), std::make_move_iterator(chunks.end()));
+        }
+        encoded.push_back("ABYS\tSYNCE:" + std::to_string(entries));
+
+        packets = std::make_shared<std::vector<std::string> const>(std::move(encoded));
+        if (accIt != _storage.end())
+            _syncCache[accountId] = packets;
+
+        ++_syncCacheMisses;
     }
 
-    SendAddonMessage(player, msg);
+    for (std::string const& packet : *packets)
+        SendOnePacket(player, packet);
+}
+
+void AbyssalStorageMgr::InvalidateSyncCache(uint32 accountId)
+{
+    _syncCache.erase(accountId);
+}
+
+void AbyssalStorageMgr::GetSyncCacheStats(uint64& hits, uint64& misses, uint32& cachedAccounts)
+{
+    std::lock_guard<std::mutex> lock(_storageMutex);
+    hits = _syncCacheHits;
+    misses = _syncCacheMisses;
+    cachedAccounts = _syncCache.size();
 }
 
+// UPD/DEL always fit in one packet; format them on the stack instead of going
+// through SendAddonMessage's string building
 void AbyssalStorageMgr::SendItemUpdate(Player* player, uint32 itemEntry, uint32 count)
 {
-    std::string msg = "UPD:" + std::to_string(itemEntry) + "," + std::to_string(count);
-    SendAddonMessage(player, msg);
+    char buf[32];
+    auto result = fmt::format_to_n(buf, sizeof(buf), "ABYS\tUPD:{},{}", itemEntry, count);
+    SendOnePacket(player, std::string_view(buf, result.size));
 }
 
 void AbyssalStorageMgr::SendItemDelete(Player* player, uint32 itemEntry)
 {
-    std::string msg = "DEL:" + std::to_string(itemEntry);
-    SendAddonMessage(player, msg);
+    char buf[32];
+    auto result = fmt::format_to_n(buf, sizeof(buf), "ABYS\tDEL:{}", itemEntry);
+    SendOnePacket(player, std::string_view(buf, result.size));
 }
@@ -1,46 +1,311 @@
 #ifndef ABYSSAL_STORAGE_H
 #define ABYSSAL_STORAGE_H
 
+#include "AsyncCallbackProcessor.h"
+#include "DatabaseEnvFwd.h"
+#include "QueryCallback.h"
+#include "Transaction.h"
 #include "DataMap.h"
 #include "Define.h"
+#include "ObjectGuid.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <unordered_map>
-#include <set>
+#include <unordered_set>
 #include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class Player;
 struct ItemTemplate;
 
+// Outcome of a vault operation; chat commands turn it into text, addon requests
+// into an ERR code (see GetAbyssalResultCode)
+enum AbyssalResult : uint8
+{
+    ABYSSAL_OK = 0,
+    ABYSSAL_ERR_DISABLED,
+    ABYSSAL_ERR_BAD_REQUEST,
+    ABYSSAL_ERR_NOT_IN_VAULT,
+    ABYSSAL_ERR_INVALID_ITEM,
+    ABYSSAL_ERR_INVALID_SPELL,
+    ABYSSAL_ERR_NOT_CRAFTABLE,
+    ABYSSAL_ERR_MISSING_REAGENTS,
+    ABYSSAL_ERR_BAG_FULL,
+    ABYSSAL_ERR_NO_MAILBOX,
+    ABYSSAL_ERR_NOTHING_TO_DO,
+};
+
+char const* GetAbyssalResultCode(AbyssalResult result);
+
+// Accounts with this bit set belong to trace replays (AbyssalStorageTrace.cpp). Their
+// vaults live only in memory and never reach the database or the realm totals.
+static constexpr uint32 ABYSSAL_REPLAY_ACCOUNT_FLAG = 0x80000000;
+
+inline bool IsReplayAccount(uint32 accountId)
+{
+    return (accountId & ABYSSAL_REPLAY_ACCOUNT_FLAG) != 0;
+}
+
+// Result summary of a bulk import/export (AbyssalStorageTransfer.cpp)
+struct AbyssalTransferStats
+{
+    uint32 accounts = 0;
+    uint64 rows = 0;
+    uint32 elapsedMs = 0;
+};
+
 struct PendingDeposit
 {
     uint32 itemEntry;
     uint32 count;
 };
 
-// Per-player transient state stored via DataMap
+// Sorted-vector set of the few item GUIDs a player has materialized. clear() keeps
+// the capacity, so after the first craft it stops allocating.
+class AbyssalGuidSet
+{
+public:
+    AbyssalGuidSet() { _guids.reserve(16); }
+
+    void insert(uint32 guid)
+    {
+        auto itr = std::lower_bound(_guids.begin(), _guids.end(), guid);
+        if (itr == _guids.end() || *itr != guid)
+            _guids.insert(itr, guid);
+    }
+
+    bool contains(uint32 guid) const { return std::binary_search(_guids.begin(), _guids.end(), guid); }
+    bool empty() const { return _guids.empty(); }
+    void clear() { _guids.clear(); }
+
+    std::vector<uint32>::const_iterator begin() const { return _guids.begin(); }
+    std::vector<uint32>::const_iterator end() const { return _guids.end(); }
+
+private:
+    std::vector<uint32> _guids;
+};
+
+// Per-player entry -> count and free bag slot index, built with one inventory walk
+// instead of one Player::GetItemCount walk per lookup. The core has no hooks for
+// destroys, moves or trades, so every hook entry point that can follow changes made
+// elsewhere calls Invalidate(); within the hook our own stores/destroys patch it.
+// Debug builds cross-check every read against a real scan.
+class AbyssalInventoryIndex
+{
+public:
+    void Invalidate() { _valid = false; }
+
+    uint32 GetItemCount(Player* player, uint32 itemEntry);
+    uint32 GetFreeSlots(Player* player);
+
+    void OnStored(uint32 itemEntry, uint32 count);
+    void OnDestroyed(uint32 itemEntry, uint32 count);
+
+private:
+    void Rebuild(Player* player);
+
+    std::unordered_map<uint32, uint32> _counts; // entries are zeroed, never erased, so rebuilds reuse nodes
+    uint32 _freeSlots = 0;
+    bool _valid = false;
+    bool _freeSlotsValid = false;
+};
+
+// Per-player transient state stored via DataMap. Containers keep their capacity
+// between uses, so once warmed up the module's own loot -> deposit bookkeeping
+// doesn't allocate. The DB statements and packets a flush sends still do.
 struct AbyssalPlayerData : public DataMap::Base
 {
+    AbyssalPlayerData()
+    {
+        pendingDeposits.reserve(16);
+        flushingDeposits.reserve(16);
+    }
+
     bool autoStoreEnabled = true;
     bool isMaterializing = false; // true while materializing items (suppress auto-deposit)
-    std::set<uint32> materializedItems; // item GUIDs currently materialized for crafting
+    AbyssalGuidSet materializedItems; // item GUIDs currently materialized for crafting
     std::vector<PendingDeposit> pendingDeposits; // deferred auto-deposits
+    std::vector<PendingDeposit> flushingDeposits; // swapped with pendingDeposits while flushing
     uint32 pendingCrafts = 0;    // remaining crafts in a multi-craft batch
     uint32 pendingSpellId = 0;   // spell ID for multi-craft batch
+    bool flushQueued = false;    // a deposit flush is waiting in the scheduler
+    bool syncQueued = false;     // a full SYNC is waiting in the scheduler
+    AbyssalInventoryIndex inventory;
 };
 
 AbyssalPlayerData* GetAbyssalData(Player* player);
 
+// Cached vault row; version mirrors abyssal_storage.version for coherent mode
+struct AbyssalVaultEntry
+{
+    uint32 count = 0;
+    uint32 version = 0;
+    uint32 lastUsed = 0; // game time, for lazy-load eviction
+};
+
+typedef std::unordered_map<uint32, AbyssalVaultEntry> AbyssalVault; // itemEntry -> row
+
+// Lazy-load bookkeeping for one account (AbyssalStorageResidency.cpp). Only the
+// entry list is loaded up front; rows become resident in the vault cache when
+// first needed and are evicted again once cold.
+struct AbyssalResidency
+{
+    std::unordered_set<uint32> known; // every entry with count > 0, resident or not
+    bool complete = false;            // every known entry is resident
+};
+
+// Page ordering for vault browsing (AbyssalStorageBrowse.cpp)
+enum AbyssalBrowseSort : uint8
+{
+    ABYSSAL_SORT_CATEGORY = 0, // class, subclass, name
+    ABYSSAL_SORT_NAME,
+    ABYSSAL_SORT_COUNT,        // largest first
+    MAX_ABYSSAL_SORT
+};
+
+// A vault's entries kept in two orders: by (class, subclass, name) so every
+// category is one contiguous range, and by name for the unfiltered list.
+// Counts are not stored; they are read from the vault when a page is built.
+struct AbyssalBrowseIndex
+{
+    std::vector<ItemTemplate const*> byCategory;
+    std::vector<ItemTemplate const*> byName;
+};
+
+struct AbyssalCategoryCount
+{
+    uint32 itemClass;
+    uint32 itemSubClass;
+    uint32 entries;
+};
+
+// Lowercase names of every storable item template, default and localized, with a
+// trigram index over them (AbyssalStorageSearch.cpp). Built once at startup.
+struct AbyssalNameIndex
+{
+    std::vector<uint32> entries;     // slot -> item entry
+    std::vector<std::string> names;  // slot -> lowercase name
+    std::unordered_map<uint32, std::vector<uint32>> trigrams; // packed trigram -> ascending slots
+};
+
+// Deferred vault work, run from the world tick within a time budget
+// (AbyssalStorageScheduler.cpp). Lower priorities run first.
+enum AbyssalWorkPriority : uint8
+{
+    ABYSSAL_WORK_CRITICAL = 0, // runs on the next tick whatever the budget
+    ABYSSAL_WORK_DEPOSIT,      // auto-deposit flushes
+    ABYSSAL_WORK_SYNC,         // full SYNCs
+    MAX_ABYSSAL_WORK_PRIORITY
+};
+
+// What a queued item does. A tag rather than a callable, so queueing copies two
+// words into the ring instead of allocating a closure per flush.
+enum AbyssalWorkType : uint8
+{
+    ABYSSAL_WORK_FLUSH_DEPOSITS,
+    ABYSSAL_WORK_SEND_SYNC,
+};
+
+struct AbyssalScheduledWork
+{
+    ObjectGuid playerGuid;
+    AbyssalWorkType type = ABYSSAL_WORK_FLUSH_DEPOSITS;
+};
+
+// FIFO ring of scheduled work. It doubles when full and never shrinks, so once it
+// has grown to the busiest tick's depth queueing stops allocating.
+class AbyssalWorkRing
+{
+public:
+    AbyssalWorkRing() { _items.resize(256); }
+
+    bool empty() const { return !_size; }
+    uint32 size() const { return _size; }
+    AbyssalScheduledWork const& front() const { return _items[_head]; }
+
+    void push_back(AbyssalScheduledWork const& work)
+    {
+        Reserve();
+        _items[(_head + _size) % _items.size()] = work;
+        ++_size;
+    }
+
+    void push_front(AbyssalScheduledWork const& work)
+    {
+        Reserve();
+        _head = (_head + _items.size() - 1) % _items.size();
+        _items[_head] = work;
+        ++_size;
+    }
+
+    void pop_front()
+    {
+        _head = (_head + 1) % _items.size();
+        --_size;
+    }
+
+private:
+    void Reserve()
+    {
+        if (_size < _items.size())
+            return;
+
+        std::vector<AbyssalScheduledWork> grown(_items.size() * 2);
+        for (uint32 i = 0; i < _size; ++i)
+            grown[i] = _items[(_head + i) % _items.size()];
+        _items = std::move(grown);
+        _head = 0;
+    }
+
+    std::vector<AbyssalScheduledWork> _items;
+    uint32 _head = 0;
+    uint32 _size = 0;
+};
+
+struct AbyssalSchedulerStats
+{
+    uint32 budgetUs = 0;
+    uint32 queued[MAX_ABYSSAL_WORK_PRIORITY] = {};
+    uint32 maxQueued = 0;   // deepest the queues have been in total
+    uint64 executed = 0;
+    uint64 carried = 0;     // ticks that left work for the next one
+    uint64 overruns = 0;    // ticks that ran past the budget
+    uint32 lastTickUs = 0;
+};
+
 class AbyssalStorageMgr
 {
 public:
     static AbyssalStorageMgr* instance();
 
     void LoadAccountData(uint32 accountId);
+    // Lazy-load mode: makes the given entries / every entry of a loaded account resident
+    void EnsureResident(uint32 accountId, std::span<uint32 const> itemEntries);
+    void EnsureFullyLoaded(uint32 accountId);
+    void SetLazyLoad(bool enabled, uint32 evictAfterSecs);
+    bool IsLazyLoad() const { return _lazyLoad; }
     void UnloadAccountData(uint32 accountId);
+    // Account-level hooks (AbyssalStorageResidency.cpp). A prefetch may be queued from
+    // any thread and runs as an async query on the next tick; a released account stays
+    // cached until its session is gone, so going back to character select keeps it warm.
+    void PrefetchAccountData(uint32 accountId);
+    void ReleaseAccountData(uint32 accountId);
     bool IsAccountLoaded(uint32 accountId);
+    // Reload a cached account from the DB and resync its online character
+    void RefreshAccount(uint32 accountId);
 
-    void DepositItem(uint32 accountId, uint32 itemEntry, uint32 count);
+    // Counts saturate at uint32 max: returns how many were stored, and the caller
+    // keeps the rest (in bags, in the mail)
+    uint32 DepositItem(uint32 accountId, uint32 itemEntry, uint32 count);
+    // Same as above, but the DB write is appended to the caller's transaction
+    uint32 DepositItem(uint32 accountId, uint32 itemEntry, uint32 count, CharacterDatabaseTransaction trans);
+    // How many more of the item the vault can hold
+    uint32 GetVaultRoom(uint32 accountId, uint32 itemEntry);
     bool WithdrawItem(uint32 accountId, uint32 itemEntry, uint32 count);
     uint32 GetItemCount(uint32 accountId, uint32 itemEntry);
     std::unordered_map<uint32, uint32> GetAllItems(uint32 accountId);
@@ -49,22 +314,184 @@ public:
     bool IsItemRequiredByActiveQuest(Player* player, uint32 itemId);
     uint32 GetQuestReservedCount(Player* player, uint32 itemId);
 
+    // Player-facing operations (AbyssalStorageOperations.cpp)
+    AbyssalResult WithdrawToInventory(Player* player, uint32 itemEntry, uint32 count, uint32& withdrawn);
+    AbyssalResult DepositInventory(Player* player, uint32& depositedStacks);
+    AbyssalResult TakeMailToVault(Player* player, uint32& attachments, uint32& itemTypes);
+    // Returns true if the purchase was charged and credited to the vault
+    bool BuyToVault(Player* player, ObjectGuid vendorGuid, uint32 vendorSlot, uint32 itemEntry, uint32 count);
+    AbyssalResult StartCraft(Player* player, uint32 spellId, uint32 count, uint32& crafts);
+    void SendCraftableCounts(Player* player, uint32 skillId);
+
+    // Bulk snapshot transfer; an empty account list exports every vault. file is a
+    // bare name inside the snapshot directory, anything with a path in it is refused.
+    void SetSnapshotDirectory(std::string const& directory) { _snapshotDirectory = directory; }
+    bool ExportVaults(std::string const& file, std::vector<uint32> const& accountIds, AbyssalTransferStats& stats, std::string& error);
+    bool ImportVaults(std::string const& file, bool replace, AbyssalTransferStats& stats, std::string& error);
+
+    // Paged browsing (AbyssalStorageBrowse.cpp). itemClass/itemSubClass -1 = any.
+    // Fills page with (itemEntry, count) and returns the size of the whole range.
+    uint32 GetVaultPage(uint32 accountId, int32 itemClass, int32 itemSubClass, AbyssalBrowseSort sort,
+        uint32 offset, uint32 limit, std::vector<std::pair<uint32, uint32>>& page);
+    std::vector<AbyssalCategoryCount> GetCategoryCounts(uint32 accountId);
+    void SendVaultPage(Player* player, int32 itemClass, int32 itemSubClass, AbyssalBrowseSort sort,
+        uint32 offset, uint32 limit, uint32& total);
+    uint32 SendCategoryCounts(Player* player);
+
+    // Name search over the vault (AbyssalStorageSearch.cpp). Matches are substrings of
+    // the lowercase name in any locale; fills (itemEntry, count) in name order, at most
+    // limit of them, and returns the number of matches.
+    void BuildNameIndex();
+    uint32 SearchVault(uint32 accountId, std::string_view query, uint32 limit, std::vector<std::pair<uint32, uint32>>& results);
+    uint32 SendSearchResults(Player* player, std::string_view query, uint32 limit);
+
+    // Addon request channel — returns true if the whisper was an ABYS request
+    bool HandleAddonRequest(Player* player, std::string_view message);
+
     // Messaging helpers
     void SendAddonMessage(Player* player, std::string const& message);
     void SendFullSync(Player* player);
     void SendItemUpdate(Player* player, uint32 itemEntry, uint32 count);
     void SendItemDelete(Player* player, uint32 itemEntry);
+    void GetSyncCacheStats(uint64& hits, uint64& misses, uint32& cachedAccounts);
+    void GetPrefetchStats(uint64& issued, uint64& abandoned, uint32& sessionAccounts);
 
     bool IsEnabled() const { return _enabled; }
     void SetEnabled(bool enabled) { _enabled = enabled; }
 
+    // Multi-process coherence (AbyssalStorageCoherence.cpp)
+    void SetCoherence(bool enabled, uint16 nodeId, uint32 pollIntervalMs, uint32 retentionSecs);
+    bool IsCoherent() const { return _coherent; }
+    void AppendChangeLog(CharacterDatabaseTransaction trans, uint32 accountId, uint32 itemEntry);
+    // Commits a transaction holding deposits; blocking in coherent mode so a
+    // withdrawal's read of the row always sees this process's own writes
+    void CommitVaultTransaction(CharacterDatabaseTransaction trans);
+
+    // Realm-wide per-item totals kept from deposit/withdraw deltas (AbyssalStorageTotals.cpp)
+    void LoadRealmTotals();
+    void SetTotalsFlushInterval(uint32 seconds);
+    uint64 GetRealmTotal(uint32 itemEntry);
+    std::vector<std::pair<uint32, uint64>> GetTopRealmTotals(uint32 limit);
+    // Recomputes abyssal_storage_totals with one full scan once no totals write is in
+    // flight; the cache reloads when it lands
+    void RebuildRealmTotals();
+    // Writes pending deltas before returning; for shutdown
+    void SaveRealmTotals();
+
+    // Tick-budgeted deferred work (AbyssalStorageScheduler.cpp). QueueWork may be
+    // called from map threads; the work itself runs on the world thread.
+    void SetTickBudget(uint32 budgetUs);
+    void QueueWork(AbyssalWorkPriority priority, ObjectGuid playerGuid, AbyssalWorkType type);
+    // Deposits everything queued by OnPlayerStoreNewItem since the last flush
+    void FlushPendingDeposits(Player* player, AbyssalPlayerData* data);
+    // At most one SYNC per player is queued at a time
+    void QueueFullSync(Player* player);
+    void GetSchedulerStats(AbyssalSchedulerStats& stats);
+    // The last tick ran out of budget with work still queued
+    bool IsWorkBacklogged() const { return _workBacklogged.load(std::memory_order_relaxed); }
+
+    // World-thread tick: scheduled work, change feed polling, totals flush and async DB callbacks
+    void Update(uint32 diff);
+
 private:
     AbyssalStorageMgr() = default;
 
-    // accountId -> (itemEntry -> count)
-    std::unordered_map<uint32, std::unordered_map<uint32, uint32>> _storage;
+    bool WithdrawItemCoherent(uint32 accountId, uint32 itemEntry, uint32 count);
+    void SetCachedEntry(uint32 accountId, uint32 itemEntry, uint32 count, uint32 version);
+    void PollChanges();
+    void RefreshChangedEntries(std::vector<std::pair<uint32, uint32>> const& changed);
+    void PruneChangeLog();
+
+    void AddRealmDelta(uint32 itemEntry, int64 delta);
+    void FlushRealmTotals(bool synchronous = false);
+    void WriteRebuiltRealmTotals();
+    void ReloadRealmTotals();
+
+    // Keeps a built browse index in step with the vault; caller holds _storageMutex
+    void UpdateBrowseIndex(uint32 accountId, uint32 itemEntry, bool present);
+    AbyssalBrowseIndex& GetBrowseIndex(uint32 accountId);
+    uint32 CollectVaultPage(uint32 accountId, int32 itemClass, int32 itemSubClass, AbyssalBrowseSort sort,
+        uint32 offset, uint32 limit, std::vector<std::pair<uint32, uint32>>& page);
+
+    std::string GetAccountLoadQuery(uint32 accountId) const;
+    // Caches a load query's rows unless the account got loaded in the meantime
+    void InstallAccountData(uint32 accountId, QueryResult result);
+    void UpdatePrefetches(uint32 diff);
+
+    // An entry's count went from zero to non-zero or back; caller holds _storageMutex
+    void SetEntryPresent(uint32 accountId, uint32 itemEntry, bool present);
+    // Drops the account's encoded SYNC after any count change; caller holds _storageMutex
+    void InvalidateSyncCache(uint32 accountId);
+    void UpdateResidency(uint32 diff);
+
+    void RunScheduledWork();
+
+    AbyssalResult HandleRequestOp(Player* player, std::string_view op, uint32& data);
+    void SendRequestReply(Player* player, uint32 requestId, uint32 opIndex, AbyssalResult result, uint32 data);
+
+    // accountId -> (itemEntry -> row)
+    std::unordered_map<uint32, AbyssalVault> _storage;
     std::mutex _storageMutex;
+    // accountId -> lazy-load state; only present for accounts loaded in lazy mode
+    std::unordered_map<uint32, AbyssalResidency> _residency;
+    bool _lazyLoad = false;
+    uint32 _evictAfterSecs = 600;
+    uint32 _evictTimer = 0;
+    // accountIds from account logins, waiting for the world tick to query them
+    std::vector<uint32> _prefetchQueue;
+    std::mutex _prefetchMutex;
+    // accounts unloaded once no session holds them; world thread only
+    std::unordered_set<uint32> _sessionAccounts;
+    uint32 _sessionSweepTimer = 0;
+    uint64 _prefetchesIssued = 0;
+    uint64 _prefetchesAbandoned = 0;
+    // accountId -> browse index, built on the first page request
+    std::unordered_map<uint32, AbyssalBrowseIndex> _browseIndex;
+    AbyssalNameIndex _nameIndex;
+    // accountId -> SYNC packet bodies as last sent; guarded by _storageMutex
+    std::unordered_map<uint32, std::shared_ptr<std::vector<std::string> const>> _syncCache;
+    uint64 _syncCacheHits = 0;
+    uint64 _syncCacheMisses = 0;
     bool _enabled = true;
+    std::string _snapshotDirectory;
+
+    AbyssalWorkRing _workQueues[MAX_ABYSSAL_WORK_PRIORITY];
+    // World thread only: work for players between maps, put back after the tick
+    std::vector<std::pair<uint8, AbyssalScheduledWork>> _waitingWork;
+    std::mutex _workMutex;
+    uint32 _tickBudgetUs = 2000;
+    uint32 _maxQueued = 0;
+    uint64 _workExecuted = 0;
+    uint64 _budgetCarries = 0;
+    uint64 _budgetOverruns = 0;
+    uint32 _lastTickUs = 0;
+    std::atomic<bool> _workBacklogged{ false };
+
+    QueryCallbackProcessor _queryProcessor;
+    AsyncCallbackProcessor<TransactionCallback> _transactionProcessor;
+
+    // itemEntry -> realm total as of the last load, plus deltas not yet written
+    std::unordered_map<uint32, int64> _realmTotals;
+    std::unordered_map<uint32, int64> _realmTotalDeltas;
+    std::mutex _totalsMutex;
+    uint32 _totalsFlushInterval = 60 * 1000;
+    uint32 _totalsFlushTimer = 0;
+    bool _totalsWriteInFlight = false;
+    bool _totalsRebuildPending = false;
+
+    bool _coherent = false;
+    uint16 _nodeId = 0;
+    uint32 _pollIntervalMs = 1000;
+    uint32 _changeRetentionSecs = 3600;
+    uint32 _pollTimer = 0;
+    uint32 _pruneTimer = 0;
+    uint64 _lastChangeId = 0;
+    // change ids skipped by the feed, re-checked until they show up or time out
+    std::map<uint64, uint32> _changeGaps; // id -> game time first missed
+    // makes every compare-and-set attempt's change row identifiable
+    std::atomic<uint64> _casSequence{ 0 };
+    bool _changeFeedStarted = false;
+    bool _pollInFlight = false;
 };
 
 #define sAbyssalStorageMgr AbyssalStorageMgr::instance()
@@ -0,0 +1,249 @@
+#include "AbyssalStorage.h"
+#include "ItemTemplate.h"
+#include "ObjectMgr.h"
+#include "Player.h"
+#include "WorldSession.h"
+#include <algorithm>
+#include <tuple>
+
+// ============================================================================
+// Paged vault browsing
+// ============================================================================
+//
+// Large vaults are browsed a page at a time instead of shipping the whole vault
+// in a SYNC. Each account gets an AbyssalBrowseIndex the first time it is paged;
+// after that deposits and withdrawals that add or remove an entry patch it with
+// a binary-searched insert/erase, so a page never re-sorts the vault.
+
+static constexpr uint32 MAX_BROWSE_PAGE = 100;
+
+static bool CategoryLess(ItemTemplate const* a, ItemTemplate const* b)
+{
+    return std::tie(a->Class, a->SubClass, a->Name1, a->ItemId) < std::tie(b->Class, b->SubClass, b->Name1, b->ItemId);
+}
+
+static bool NameLess(ItemTemplate const* a, ItemTemplate const* b)
+{
+    return std::tie(a->Name1, a->ItemId) < std::tie(b->Name1, b->ItemId);
+}
+
+template <typename Less>
+static void PatchSorted(std::vector<ItemTemplate const*>& items, ItemTemplate const* item, bool present, Less less)
+{
+    auto itr = std::lower_bound(items.begin(), items.end(), item, less);
+    bool found = itr != items.end() && *itr == item;
+
+    if (present && !found)
+        items.insert(itr, item);
+    else if (!present && found)
+        items.erase(itr);
+}
+
+AbyssalBrowseIndex& AbyssalStorageMgr::GetBrowseIndex(uint32 accountId)
+{
+    auto [itr, inserted] = _browseIndex.try_emplace(accountId);
+    if (!inserted)
+        return itr->second;
+
+    AbyssalBrowseIndex& index = itr->second;
+    auto addEntry = [&index](uint32 entry)
+    {
+        // Entries without a template can't be categorized; nothing could create them anyway
+        if (ItemTemplate const* proto = sObjectMgr->GetItemTemplate(entry))
+            index.byCategory.push_back(proto);
+    };
+
+    // Lazily loaded accounts may not have every row resident, but they know every entry
+    auto resIt = _residency.find(accountId);
+    if (resIt != _residency.end())
+    {
+        index.byCategory.reserve(resIt->second.known.size());
+        for (uint32 entry : resIt->second.known)
+            addEntry(entry);
+    }
+    else
+    {
+        AbyssalVault const& vault = _storage[accountId];
+        index.byCategory.reserve(vault.size());
+        for (auto const& [entry, row] : vault)
+            addEntry(entry);
+    }
+
+    index.byName = index.byCategory;
+    std::sort(index.byCategory.begin(), index.byCategory.end(), CategoryLess);
+    std::sort(index.byName.begin(), index.byName.end(), NameLess);
+    return index;
+}
+
+void AbyssalStorageMgr::UpdateBrowseIndex(uint32 accountId, uint32 itemEntry, bool present)
+{
+    auto itr = _browseIndex.find(accountId);
+    if (itr == _browseIndex.end())
+        return;
+
+    ItemTemplate const* proto = sObjectMgr->GetItemTemplate(itemEntry);
+    if (!proto)
+        return;
+
+    PatchSorted(itr->second.byCategory, proto, present, CategoryLess);
+    PatchSorted(itr->second.byName, proto, present, NameLess);
+}
+
+uint32 AbyssalStorageMgr::GetVaultPage(uint32 accountId, int32 itemClass, int32 itemSubClass, AbyssalBrowseSort sort,
+    uint32 offset, uint32 limit, std::vector<std::pair<uint32, uint32>>& page)
+{
+    page.clear();
+    limit = std::min(limit, MAX_BROWSE_PAGE);
+
+    // Ordering by count needs every count; the other orders only need the page's
+    if (sort == ABYSSAL_SORT_COUNT)
+        EnsureFullyLoaded(accountId);
+
+    uint32 total = CollectVaultPage(accountId, itemClass, itemSubClass, sort, offset, limit, page);
+
+    std::vector<uint32> entries;
+    entries.reserve(page.size());
+    for (auto const& [entry, count] : page)
+        entries.push_back(entry);
+    EnsureResident(accountId, entries);
+
+    for (auto& [entry, count] : page)
+        count = GetItemCount(accountId, entry);
+
+    return total;
+}
+
+// Fills page with the entries of the requested slice; counts are left to the caller
+uint32 AbyssalStorageMgr::CollectVaultPage(uint32 accountId, int32 itemClass, int32 itemSubClass, AbyssalBrowseSort sort,
+    uint32 offset, uint32 limit, std::vector<std::pair<uint32, uint32>>& page)
+{
+    std::lock_guard<std::mutex> lock(_storageMutex);
+
+    auto accIt = _storage.find(accountId);
+    if (accIt == _storage.end())
+        return 0;
+
+    AbyssalVault const& vault = accIt->second;
+    AbyssalBrowseIndex& index = GetBrowseIndex(accountId);
+
+    // The category's range in byCategory; a subclass filter without a class matches nothing
+    auto first = index.byCategory.begin();
+    auto last = index.byCategory.end();
+    if (itemClass >= 0)
+    {
+        auto key = [itemClass, itemSubClass](ItemTemplate const* proto)
+        {
+            return std::make_pair(int32(proto->Class), itemSubClass >= 0 ? int32(proto->SubClass) : 0);
+        };
+        std::pair<int32, int32> wanted(itemClass, std::max(itemSubClass, 0));
+
+        first = std::partition_point(first, last, [&](ItemTemplate const* proto) { return key(proto) < wanted; });
+        last = std::partition_point(first, last, [&](ItemTemplate const* proto) { return !(wanted < key(proto)); });
+    }
+    else if (itemSubClass >= 0)
+        last = first;
+
+    uint32 total = uint32(last - first);
+    if (offset >= total || !limit)
+        return total;
+
+    uint32 end = std::min(total, offset + limit);
+    page.reserve(end - offset);
+
+    auto countOf = [&vault](ItemTemplate const* proto)
+    {
+        auto itr = vault.find(proto->ItemId);
+        return itr != vault.end() ? itr->second.count : 0;
+    };
+
+    if (sort == ABYSSAL_SORT_NAME && itemClass < 0)
+    {
+        for (uint32 i = offset; i < end; ++i)
+            page.emplace_back(index.byName[i]->ItemId, 0);
+        return total;
+    }
+
+    // A single subclass is already in name order inside byCategory
+    if (sort == ABYSSAL_SORT_CATEGORY || (sort == ABYSSAL_SORT_NAME && itemSubClass >= 0))
+    {
+        for (auto itr = first + offset; itr != first + end; ++itr)
+            page.emplace_back((*itr)->ItemId, 0);
+        return total;
+    }
+
+    // Re-ordered ranges only sort as far as the requested page reaches
+    std::vector<ItemTemplate const*> ordered(first, last);
+    if (sort == ABYSSAL_SORT_COUNT)
+    {
+        std::partial_sort(ordered.begin(), ordered.begin() + end, ordered.end(), [&](ItemTemplate const* a, ItemTemplate const* b)
+        {
+            uint32 countA = countOf(a);
+            uint32 countB = countOf(b);
+            return countA != countB ? countA > countB : NameLess(a, b);
+        });
+    }
+    else
+        std::partial_sort(ordered.begin(), ordered.begin() + end, ordered.end(), NameLess);
+
+    for (uint32 i = offset; i < end; ++i)
+        page.emplace_back(ordered[i]->ItemId, 0);
+
+    return total;
+}
+
+std::vector<AbyssalCategoryCount> AbyssalStorageMgr::GetCategoryCounts(uint32 accountId)
+{
+    std::vector<AbyssalCategoryCount> counts;
+
+    std::lock_guard<std::mutex> lock(_storageMutex);
+
+    auto accIt = _storage.find(accountId);
+    if (accIt == _storage.end())
+        return counts;
+
+    // Categories are contiguous runs in byCategory
+    for (ItemTemplate const* proto : GetBrowseIndex(accountId).byCategory)
+    {
+        if (counts.empty() || counts.back().itemClass != proto->Class || counts.back().itemSubClass != proto->SubClass)
+            counts.push_back({ proto->Class, proto->SubClass, 0 });
+        ++counts.back().entries;
+    }
+
+    return counts;
+}
+
+// PAGE:entry,count;... — may be split over several packets, the request's ACK
+// (carrying the range size) marks the end
+void AbyssalStorageMgr::SendVaultPage(Player* player, int32 itemClass, int32 itemSubClass, AbyssalBrowseSort sort,
+    uint32 offset, uint32 limit, uint32& total)
+{
+    std::vector<std::pair<uint32, uint32>> page;
+    total = GetVaultPage(player->GetSession()->GetAccountId(), itemClass, itemSubClass, sort, offset, limit, page);
+
+    std::string msg = "PAGE:";
+    for (std::size_t i = 0; i < page.size(); ++i)
+    {
+        if (i)
+            msg += ";";
+        msg += std::to_string(page[i].first) + "," + std::to_string(page[i].second);
+    }
+
+    SendAddonMessage(player, msg);
+}
+
+// CATS:class,subclass,entries;...
+uint32 AbyssalStorageMgr::SendCategoryCounts(Player* player)
+{
+    std::vector<AbyssalCategoryCount> counts = GetCategoryCounts(player->GetSession()->GetAccountId());
+
+    std::string msg = "CATS:";
+    for (std::size_t i = 0; i < counts.size(); ++i)
+    {
+        if (i)
+            msg += ";";
+        msg += std::to_string(counts[i].itemClass) + "," + std::to_string(counts[i].itemSubClass) + "," + std::to_string(counts[i].entries);
+    }
+
+    SendAddonMessage(player, msg);
+    return counts.size();
+}
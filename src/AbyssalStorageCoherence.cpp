@@ -0,0 +1,316 @@
+#include "AbyssalStorage.h"
+#include "DatabaseEnv.h"
+#include "GameTime.h"
+#include "Log.h"
+#include "Player.h"
+#include "World.h"
+#include "WorldSession.h"
+
+// ============================================================================
+// Multi-process coherence
+// ============================================================================
+//
+// Several worldservers may share one characters DB. Every write bumps the row's
+// version and, in coherent mode, records (account, item, version, origin) in
+// abyssal_storage_changes. The unique key on (account_id, item_entry, version)
+// makes that table the arbiter for compare-and-set withdrawals: whoever logs
+// version V+1 owns the transition from V. A withdrawal tags its change row with
+// a token unique to the attempt, since a deposit from this same process can log
+// V+1 too. Each process polls the table and re-reads the rows that changed for
+// the accounts it has cached.
+//
+// Change ids are assigned at insert but become visible at commit, so the feed can
+// see id N+1 before N. Ids it skipped are asked for again on later polls until
+// they appear or CHANGE_GAP_TIMEOUT passes (rolled back or lost to INSERT IGNORE).
+
+static constexpr uint32 COHERENT_WITHDRAW_ATTEMPTS = 3;
+static constexpr uint32 CHANGE_FEED_BATCH = 1000;
+static constexpr uint32 CHANGE_PRUNE_INTERVAL = 60 * 1000;
+static constexpr uint32 CHANGE_GAP_TIMEOUT = 30;   // seconds
+static constexpr uint32 MAX_CHANGE_GAPS = 1000;
+
+void AbyssalStorageMgr::SetCoherence(bool enabled, uint16 nodeId, uint32 pollIntervalMs, uint32 retentionSecs)
+{
+    if (enabled && !nodeId)
+    {
+        LOG_ERROR("module", "AbyssalStorage: Coherence.Enable requires a non-zero Coherence.NodeId, coherence stays disabled");
+        enabled = false;
+    }
+
+    _coherent = enabled;
+    _nodeId = nodeId;
+    _pollIntervalMs = std::max<uint32>(pollIntervalMs, 100);
+    _changeRetentionSecs = std::max<uint32>(retentionSecs, 60);
+    // Tokens from an earlier run of this node must not look like ours
+    _casSequence = uint64(GameTime::GetGameTime().count()) << 16;
+}
+
+void AbyssalStorageMgr::AppendChangeLog(CharacterDatabaseTransaction trans, uint32 accountId, uint32 itemEntry)
+{
+    // Runs after the row update inside the same transaction, so it reads the version we just wrote
+    trans->Append("INSERT IGNORE INTO abyssal_storage_changes (account_id, item_entry, version, origin) "
+        "SELECT account_id, item_entry, version, {} FROM abyssal_storage WHERE account_id = {} AND item_entry = {}",
+        _nodeId, accountId, itemEntry);
+}
+
+void AbyssalStorageMgr::CommitVaultTransaction(CharacterDatabaseTransaction trans)
+{
+    // WithdrawItemCoherent reads the row on the synchronous connection, which can't
+    // see writes still sitting in the async queue. Reading a stale count there would
+    // fail the compare-and-set and put the stale count back in the cache.
+    if (_coherent)
+        CharacterDatabase.DirectCommitTransaction(trans);
+    else
+        CharacterDatabase.CommitTransaction(trans);
+}
+
+void AbyssalStorageMgr::SetCachedEntry(uint32 accountId, uint32 itemEntry, uint32 count, uint32 version)
+{
+    std::lock_guard<std::mutex> lock(_storageMutex);
+
+    auto accIt = _storage.find(accountId);
+    if (accIt == _storage.end())
+        return;
+
+    if (count == 0)
+        accIt->second.erase(itemEntry);
+    else
+        accIt->second[itemEntry] = { count, version, uint32(GameTime::GetGameTime().count()) };
+
+    InvalidateSyncCache(accountId);
+    SetEntryPresent(accountId, itemEntry, count != 0);
+}
+
+bool AbyssalStorageMgr::WithdrawItemCoherent(uint32 accountId, uint32 itemEntry, uint32 count)
+{
+    if (!IsAccountLoaded(accountId))
+        return false;
+
+    for (uint32 attempt = 0; attempt < COHERENT_WITHDRAW_ATTEMPTS; ++attempt)
+    {
+        // Read the authoritative row; another process may have changed it since we cached it
+        QueryResult result = CharacterDatabase.Query("SELECT count, version FROM abyssal_storage WHERE account_id = {} AND item_entry = {}", accountId, itemEntry);
+        uint32 dbCount = result ? result->Fetch()[0].Get<uint32>() : 0;
+        uint32 dbVersion = result ? result->Fetch()[1].Get<uint32>() : 0;
+
+        if (dbCount < count)
+        {
+            SetCachedEntry(accountId, itemEntry, dbCount, dbVersion);
+            return false;
+        }
+
+        // Compare-and-set on version; the change log row for V+1 records who won.
+        // If the UPDATE matched nothing, whoever moved the row to V+1 already holds
+        // that key and our INSERT IGNORE is dropped, so only our token proves a win.
+        uint64 token = (uint64(_nodeId) << 48) | (++_casSequence & 0xFFFFFFFFFFFF);
+        CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+        trans->Append("UPDATE abyssal_storage SET count = count - {}, version = version + 1 "
+            "WHERE account_id = {} AND item_entry = {} AND version = {}", count, accountId, itemEntry, dbVersion);
+        trans->Append("INSERT IGNORE INTO abyssal_storage_changes (account_id, item_entry, version, origin, cas_token) "
+            "SELECT account_id, item_entry, version, {}, {} FROM abyssal_storage WHERE account_id = {} AND item_entry = {} AND version = {}",
+            _nodeId, token, accountId, itemEntry, dbVersion + 1);
+        CharacterDatabase.DirectCommitTransaction(trans);
+
+        QueryResult winner = CharacterDatabase.Query("SELECT cas_token FROM abyssal_storage_changes WHERE account_id = {} AND item_entry = {} AND version = {}",
+            accountId, itemEntry, dbVersion + 1);
+        if (winner && winner->Fetch()[0].Get<uint64>() == token)
+        {
+            SetCachedEntry(accountId, itemEntry, dbCount - count, dbVersion + 1);
+            AddRealmDelta(itemEntry, -int64(count));
+            return true;
+        }
+
+        LOG_DEBUG("module", "AbyssalStorage: CAS conflict on account {} item {} (version {}), retrying", accountId, itemEntry, dbVersion);
+    }
+
+    return false;
+}
+
+void AbyssalStorageMgr::Update(uint32 diff)
+{
+    _queryProcessor.ProcessReadyCallbacks();
+    _transactionProcessor.ProcessReadyCallbacks();
+
+    RunScheduledWork();
+    UpdateResidency(diff);
+    UpdatePrefetches(diff);
+
+    _totalsFlushTimer += diff;
+    if (_totalsRebuildPending && !_totalsWriteInFlight)
+    {
+        // Takes the place of the next flush; the scan covers the pending deltas
+        _totalsFlushTimer = 0;
+        WriteRebuiltRealmTotals();
+    }
+    else if (_totalsFlushTimer >= _totalsFlushInterval && !_totalsWriteInFlight)
+    {
+        _totalsFlushTimer = 0;
+        FlushRealmTotals();
+    }
+
+    if (!_coherent)
+        return;
+
+    _pollTimer += diff;
+    if (_pollTimer >= _pollIntervalMs && !_pollInFlight)
+    {
+        _pollTimer = 0;
+        PollChanges();
+    }
+
+    _pruneTimer += diff;
+    if (_pruneTimer >= CHANGE_PRUNE_INTERVAL)
+    {
+        _pruneTimer = 0;
+        PruneChangeLog();
+    }
+}
+
+void AbyssalStorageMgr::PollChanges()
+{
+    if (!_changeFeedStarted)
+    {
+        // Only changes made after we start matter — everything older is already in the rows we load
+        QueryResult result = CharacterDatabase.Query("SELECT COALESCE(MAX(id), 0) FROM abyssal_storage_changes");
+        _lastChangeId = result ? result->Fetch()[0].Get<uint64>() : 0;
+        _changeFeedStarted = true;
+        return;
+    }
+
+    // Ids the feed skipped so far are asked for again until they time out
+    uint32 now = uint32(GameTime::GetGameTime().count());
+    std::string gaps;
+    for (auto itr = _changeGaps.begin(); itr != _changeGaps.end();)
+    {
+        if (now - itr->second > CHANGE_GAP_TIMEOUT)
+        {
+            itr = _changeGaps.erase(itr);
+            continue;
+        }
+
+        if (!gaps.empty())
+            gaps += ",";
+        gaps += std::to_string(itr->first);
+        ++itr;
+    }
+
+    // Our own changes are included on purpose: re-reading them after commit folds in
+    // any concurrent writes that landed between our cache update and the DB write
+    _pollInFlight = true;
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormat(
+        "SELECT id, account_id, item_entry FROM abyssal_storage_changes WHERE id > {}{}{}{} ORDER BY id LIMIT {}",
+        _lastChangeId, gaps.empty() ? "" : " OR id IN (", gaps, gaps.empty() ? "" : ")", CHANGE_FEED_BATCH))
+        .WithCallback([this, now](QueryResult result)
+    {
+        _pollInFlight = false;
+        if (!result)
+            return;
+
+        std::vector<std::pair<uint32, uint32>> changed;
+        do
+        {
+            Field* fields = result->Fetch();
+            uint64 id = fields[0].Get<uint64>();
+
+            if (id <= _lastChangeId)
+                _changeGaps.erase(id);
+            else
+            {
+                // Lower ids not visible yet may still commit
+                for (uint64 missing = _lastChangeId + 1; missing < id && _changeGaps.size() < MAX_CHANGE_GAPS; ++missing)
+                    _changeGaps.emplace(missing, now);
+                _lastChangeId = id;
+            }
+
+            uint32 accountId = fields[1].Get<uint32>();
+            if (IsAccountLoaded(accountId))
+                changed.emplace_back(accountId, fields[2].Get<uint32>());
+        } while (result->NextRow());
+
+        if (!changed.empty())
+            RefreshChangedEntries(changed);
+    }));
+}
+
+void AbyssalStorageMgr::RefreshChangedEntries(std::vector<std::pair<uint32, uint32>> const& changed)
+{
+    std::string keys;
+    for (auto const& [accountId, itemEntry] : changed)
+    {
+        if (!keys.empty())
+            keys += ",";
+        keys += "(" + std::to_string(accountId) + "," + std::to_string(itemEntry) + ")";
+    }
+
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(Acore::StringFormat(
+        "SELECT account_id, item_entry, count, version FROM abyssal_storage WHERE (account_id, item_entry) IN ({})", keys))
+        .WithCallback([this, changed](QueryResult result)
+    {
+        // (account, item) -> (count, version); rows that vanished count as zero
+        std::map<std::pair<uint32, uint32>, AbyssalVaultEntry> rows;
+        for (auto const& key : changed)
+            rows[key] = { 0, 0 };
+
+        if (result)
+        {
+            do
+            {
+                Field* fields = result->Fetch();
+                rows[{ fields[0].Get<uint32>(), fields[1].Get<uint32>() }] = { fields[2].Get<uint32>(), fields[3].Get<uint32>() };
+            } while (result->NextRow());
+        }
+
+        for (auto const& [key, row] : rows)
+        {
+            uint32 accountId = key.first;
+            uint32 itemEntry = key.second;
+
+            bool updated = false;
+            {
+                std::lock_guard<std::mutex> lock(_storageMutex);
+                auto accIt = _storage.find(accountId);
+                if (accIt == _storage.end())
+                    continue;
+
+                auto itemIt = accIt->second.find(itemEntry);
+                uint32 cachedCount = itemIt != accIt->second.end() ? itemIt->second.count : 0;
+                uint32 cachedVersion = itemIt != accIt->second.end() ? itemIt->second.version : 0;
+
+                // Never roll back to an older row than one we wrote ourselves
+                if (row.version && row.version < cachedVersion)
+                    continue;
+
+                if (row.count == 0)
+                {
+                    if (itemIt != accIt->second.end())
+                        accIt->second.erase(itemIt);
+                }
+                else
+                    accIt->second[itemEntry] = { row.count, row.version, uint32(GameTime::GetGameTime().count()) };
+
+                SetEntryPresent(accountId, itemEntry, row.count != 0);
+                updated = cachedCount != row.count;
+                if (updated)
+                    InvalidateSyncCache(accountId);
+            }
+
+            if (!updated)
+                continue;
+
+            WorldSession* session = sWorld->FindSession(accountId);
+            Player* player = session ? session->GetPlayer() : nullptr;
+            if (!player || !player->IsInWorld())
+                continue;
+
+            if (row.count)
+                SendItemUpdate(player, itemEntry, row.count);
+            else
+                SendItemDelete(player, itemEntry);
+        }
+    }));
+}
+
+void AbyssalStorageMgr::PruneChangeLog()
+{
+    CharacterDatabase.Execute("DELETE FROM abyssal_storage_changes WHERE changed_at < NOW() - INTERVAL {} SECOND", _changeRetentionSecs);
+}
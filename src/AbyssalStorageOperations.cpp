@@ -0,0 +1,706 @@
+#include "AbyssalStorage.h"
+#include "AbyssalStorageTrace.h"
+#include "ConditionMgr.h"
+#include "Creature.h"
+#include "DatabaseEnv.h"
+#include "GameTime.h"
+#include "Item.h"
+#include "Mail.h"
+#include "ObjectMgr.h"
+#include "Player.h"
+#include "SpellInfo.h"
+#include "SpellMgr.h"
+#include "StringConvert.h"
+#include "Tokenize.h"
+#include "WorldPacket.h"
+#include "WorldSession.h"
+#include <cmath>
+#include <limits>
+
+// Machine-readable codes used in ERR replies to addon requests
+char const* GetAbyssalResultCode(AbyssalResult result)
+{
+    switch (result)
+    {
+        case ABYSSAL_OK:                    return "OK";
+        case ABYSSAL_ERR_DISABLED:          return "DISABLED";
+        case ABYSSAL_ERR_BAD_REQUEST:       return "BAD_REQUEST";
+        case ABYSSAL_ERR_NOT_IN_VAULT:      return "NOT_IN_VAULT";
+        case ABYSSAL_ERR_INVALID_ITEM:      return "INVALID_ITEM";
+        case ABYSSAL_ERR_INVALID_SPELL:     return "INVALID_SPELL";
+        case ABYSSAL_ERR_NOT_CRAFTABLE:     return "NOT_CRAFTABLE";
+        case ABYSSAL_ERR_MISSING_REAGENTS:  return "MISSING_REAGENTS";
+        case ABYSSAL_ERR_BAG_FULL:          return "BAG_FULL";
+        case ABYSSAL_ERR_NO_MAILBOX:        return "NO_MAILBOX";
+        case ABYSSAL_ERR_NOTHING_TO_DO:     return "NOTHING_TO_DO";
+    }
+    return "UNKNOWN";
+}
+
+// ============================================================================
+// Vault Operations — shared by chat commands and addon requests
+// ============================================================================
+
+AbyssalResult AbyssalStorageMgr::WithdrawToInventory(Player* player, uint32 itemEntry, uint32 count, uint32& withdrawn)
+{
+    withdrawn = 0;
+
+    uint32 accountId = player->GetSession()->GetAccountId();
+    uint32 vaultCount = GetItemCount(accountId, itemEntry);
+
+    if (vaultCount == 0)
+        return ABYSSAL_ERR_NOT_IN_VAULT;
+
+    // 0 means "everything in the vault"
+    if (count == 0 || count > vaultCount)
+        count = vaultCount;
+
+    ItemTemplate const* itemTemplate = sObjectMgr->GetItemTemplate(itemEntry);
+    if (!itemTemplate)
+        return ABYSSAL_ERR_INVALID_ITEM;
+
+    // Disable auto-store BEFORE creating items, otherwise OnPlayerStoreNewItem
+    // will immediately re-deposit them back into the vault
+    AbyssalPlayerData* data = GetAbyssalData(player);
+    if (data)
+        data->autoStoreEnabled = false;
+
+    // Add items to player in stacks respecting max stack size
+    bool bagFull = false;
+    uint32 remaining = count;
+    while (remaining > 0)
+    {
+        uint32 stackSize = std::min(remaining, itemTemplate->GetMaxStackSize());
+
+        ItemPosCountVec dest;
+        InventoryResult result = player->CanStoreNewItem(NULL_BAG, NULL_SLOT, dest, itemEntry, stackSize);
+        if (result != EQUIP_ERR_OK)
+        {
+            bagFull = true;
+            break;
+        }
+
+        // Take it from the vault first: in coherent mode another worldserver may have
+        // withdrawn it since we read the count
+        if (!WithdrawItem(accountId, itemEntry, stackSize))
+            break;
+
+        if (!player->StoreNewItem(dest, itemEntry, true))
+        {
+            DepositItem(accountId, itemEntry, stackSize);
+            break;
+        }
+        remaining -= stackSize;
+    }
+
+    withdrawn = count - remaining;
+    if (withdrawn == 0)
+        return bagFull ? ABYSSAL_ERR_BAG_FULL : ABYSSAL_ERR_NOT_IN_VAULT;
+
+    uint32 newCount = GetItemCount(accountId, itemEntry);
+    if (newCount > 0)
+        SendItemUpdate(player, itemEntry, newCount);
+    else
+        SendItemDelete(player, itemEntry);
+
+    return ABYSSAL_OK;
+}
+
+AbyssalResult AbyssalStorageMgr::DepositInventory(Player* player, uint32& depositedStacks)
+{
+    depositedStacks = 0;
+
+    uint32 accountId = player->GetSession()->GetAccountId();
+    AbyssalPlayerData* data = GetAbyssalData(player);
+    data->inventory.Invalidate(); // ShouldAutoStore reads it for quest reservations
+
+    // Collect totals first — DestroyItemCount searches the whole inventory,
+    // so destroying during iteration can skip stacks of the same item
+    std::unordered_map<uint32, uint32> toDeposit; // itemEntry -> totalCount
+
+    for (uint8 bag = INVENTORY_SLOT_BAG_START; bag < INVENTORY_SLOT_BAG_END; ++bag)
+    {
+        if (Bag* pBag = player->GetBagByPos(bag))
+        {
+            for (uint8 slot = 0; slot < pBag->GetBagSize(); ++slot)
+            {
+                Item* item = pBag->GetItemByPos(slot);
+                if (!item)
+                    continue;
+
+                if (ShouldAutoStore(player, item->GetTemplate()))
+                    toDeposit[item->GetEntry()] += item->GetCount();
+            }
+        }
+    }
+
+    // Also scan the default backpack (slots 23-38)
+    for (uint8 slot = INVENTORY_SLOT_ITEM_START; slot < INVENTORY_SLOT_ITEM_END; ++slot)
+    {
+        Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, slot);
+        if (!item)
+            continue;
+
+        if (ShouldAutoStore(player, item->GetTemplate()))
+            toDeposit[item->GetEntry()] += item->GetCount();
+    }
+
+    // Now deposit and destroy in one pass per item entry; what a full vault count
+    // can't take stays in the bags
+    for (auto const& [entry, count] : toDeposit)
+    {
+        uint32 stored = DepositItem(accountId, entry, count);
+        if (!stored)
+            continue;
+
+        player->DestroyItemCount(entry, stored, true);
+        data->inventory.OnDestroyed(entry, stored);
+        ++depositedStacks;
+    }
+
+    data->autoStoreEnabled = true;
+
+    // Per-entry updates rather than a full SYNC, which would load a lazily loaded vault in full
+    for (auto const& [entry, count] : toDeposit)
+        SendItemUpdate(player, entry, GetItemCount(accountId, entry));
+
+    return ABYSSAL_OK;
+}
+
+// Credits every vault-eligible mail attachment straight into the vault.
+// Attachments are never created in bags, so a full inventory doesn't matter.
+AbyssalResult AbyssalStorageMgr::TakeMailToVault(Player* player, uint32& attachments, uint32& itemTypes)
+{
+    attachments = 0;
+    itemTypes = 0;
+
+    if (!player->FindNearestGameObjectOfType(GAMEOBJECT_TYPE_MAILBOX, INTERACTION_DISTANCE))
+        return ABYSSAL_ERR_NO_MAILBOX;
+
+    uint32 accountId = player->GetSession()->GetAccountId();
+    time_t now = GameTime::GetGameTime().count();
+
+    GetAbyssalData(player)->inventory.Invalidate();
+
+    // Totals per entry so the vault gets one write per item type
+    std::unordered_map<uint32, uint32> credited; // itemEntry -> totalCount
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+    for (PlayerMails::iterator itr = player->GetMailBegin(); itr != player->GetMailEnd(); ++itr)
+    {
+        Mail* mail = *itr;
+        if (mail->state == MAIL_STATE_DELETED || mail->deliver_time > now)
+            continue;
+
+        // COD mails must be paid through the normal mailbox flow
+        if (mail->COD || !mail->HasItems())
+            continue;
+
+        // Copy — RemoveItem below mutates mail->items
+        std::vector<MailItemInfo> mailItems = mail->items;
+        for (MailItemInfo const& info : mailItems)
+        {
+            Item* item = player->GetMItem(info.item_guid);
+            if (!item)
+                continue;
+
+            if (!ShouldAutoStore(player, item->GetTemplate()))
+                continue;
+
+            uint32 entry = item->GetEntry();
+            uint32 count = item->GetCount();
+
+            // An attachment is taken whole; one the vault count can't hold stays in the mail
+            auto creditedItr = credited.find(entry);
+            if (count > GetVaultRoom(accountId, entry) - (creditedItr != credited.end() ? creditedItr->second : 0))
+                continue;
+
+            mail->RemoveItem(info.item_guid);
+            mail->removedItems.push_back(info.item_guid);
+            mail->state = MAIL_STATE_CHANGED;
+            player->m_mailsUpdated = true;
+            player->RemoveMItem(info.item_guid);
+
+            item->DeleteFromDB(trans);
+            delete item;
+
+            player->SendMailResult(mail->messageID, MAIL_ITEM_TAKEN, MAIL_OK, 0, info.item_guid, count);
+
+            credited[entry] += count;
+            ++attachments;
+        }
+    }
+
+    if (credited.empty())
+        return ABYSSAL_ERR_NOTHING_TO_DO;
+
+    for (auto const& [entry, count] : credited)
+        DepositItem(accountId, entry, count, trans);
+
+    player->_SaveMail(trans);
+    CommitVaultTransaction(trans);
+
+    for (auto const& [entry, count] : credited)
+        SendItemUpdate(player, entry, GetItemCount(accountId, entry));
+
+    itemTypes = credited.size();
+    return ABYSSAL_OK;
+}
+
+// A vendor purchase paid in gold and credited to the vault without creating the
+// items. Anything the core's buy path would treat specially (extended cost,
+// limited stock, reputation, vendor conditions, faction or BoP items) or refuse
+// (not enough money) returns false and is left to the core, which does its own
+// checks and sends the errors.
+bool AbyssalStorageMgr::BuyToVault(Player* player, ObjectGuid vendorGuid, uint32 vendorSlot, uint32 itemEntry, uint32 count)
+{
+    AbyssalPlayerData* data = GetAbyssalData(player);
+    if (!data || !data->autoStoreEnabled || data->isMaterializing || !count)
+        return false;
+
+    ItemTemplate const* proto = sObjectMgr->GetItemTemplate(itemEntry);
+    if (!proto || proto->BuyPrice <= 0 || proto->Bonding == BIND_WHEN_PICKED_UP || proto->RequiredReputationFaction
+        || (proto->Flags2 & (ITEM_FLAG2_FACTION_HORDE | ITEM_FLAG2_FACTION_ALLIANCE)))
+        return false;
+
+    data->inventory.Invalidate(); // ShouldAutoStore reads it for quest reservations
+    if (!ShouldAutoStore(player, proto))
+        return false;
+
+    Creature* vendor = player->GetNPCIfCanInteractWith(vendorGuid, UNIT_NPC_FLAG_VENDOR);
+    if (!vendor)
+        return false;
+
+    uint32 currentVendor = player->GetSession()->GetCurrentVendor();
+    VendorItemData const* vendorItems = currentVendor ? sObjectMgr->GetNpcVendorItemList(currentVendor) : vendor->GetVendorItems();
+    if (!vendorItems || vendorSlot >= vendorItems->GetItemCount())
+        return false;
+
+    VendorItem const* vendorItem = vendorItems->GetItem(vendorSlot);
+    if (!vendorItem || vendorItem->item != itemEntry || vendorItem->maxcount || vendorItem->ExtendedCost || !vendorItem->IsGoldRequired(proto))
+        return false;
+
+    if (!sConditionMgr->GetConditionsForNpcVendorEvent(vendor->GetEntry(), itemEntry).empty())
+        return false;
+
+    // Same price as Player::BuyItemFromVendorSlot
+    if (count > MAX_MONEY_AMOUNT / uint32(proto->BuyPrice))
+        return false;
+    uint32 price = uint32(proto->BuyPrice) * count;
+    price = uint32(std::floor(price * player->GetReputationPriceDiscount(vendor)));
+    if (!player->HasEnoughMoney(price))
+        return false;
+
+    // Don't charge for items a saturated vault count would drop
+    uint32 accountId = player->GetSession()->GetAccountId();
+    uint32 quantity = std::max<uint32>(proto->BuyCount, 1) * count;
+    if (quantity > GetVaultRoom(accountId, itemEntry))
+        return false;
+
+    sAbyssalTrace->Record(ABYSSAL_TRACE_STORE_ITEM, accountId, itemEntry, quantity);
+
+    player->ModifyMoney(-int32(price));
+    DepositItem(accountId, itemEntry, quantity);
+    SendItemUpdate(player, itemEntry, GetItemCount(accountId, itemEntry));
+
+    // The reply the core sends for a purchase; the client updates the merchant frame
+    WorldPacket packet(SMSG_BUY_ITEM, 8 + 4 + 4 + 4);
+    packet << vendor->GetGUID();
+    packet << uint32(vendorSlot + 1);
+    packet << int32(-1); // unlimited stock
+    packet << uint32(count);
+    player->GetSession()->SendPacket(&packet);
+    return true;
+}
+
+// Materializes reagents from vault and casts the crafting spell
+AbyssalResult AbyssalStorageMgr::StartCraft(Player* player, uint32 spellId, uint32 count, uint32& crafts)
+{
+    crafts = 0;
+
+    SpellInfo const* spellInfo = sSpellMgr->GetSpellInfo(spellId);
+    if (!spellInfo)
+        return ABYSSAL_ERR_INVALID_SPELL;
+
+    // Verify spell has reagents
+    bool hasReagents = false;
+    for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+    {
+        if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0)
+        {
+            hasReagents = true;
+            break;
+        }
+    }
+
+    if (!hasReagents)
+        return ABYSSAL_ERR_NOT_CRAFTABLE;
+
+    uint32 accountId = player->GetSession()->GetAccountId();
+    uint32 craftCount = count ? count : 1;
+
+    AbyssalPlayerData* data = GetAbyssalData(player);
+    data->inventory.Invalidate();
+
+    // Lazy-load mode: one query for every reagent row instead of one per reagent
+    std::vector<uint32> reagentEntries;
+    for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+    {
+        if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0)
+            reagentEntries.push_back(spellInfo->Reagent[i]);
+    }
+    EnsureResident(accountId, reagentEntries);
+
+    // Gather reagent info: what the player has, what the vault has, per-craft need
+    struct ReagentInfo
+    {
+        int32  entry;
+        uint32 perCraft;
+        uint32 playerHas;
+        uint32 vaultHas;
+        uint32 maxStack;
+    };
+    std::vector<ReagentInfo> reagents;
+
+    for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+    {
+        int32 reagentEntry = spellInfo->Reagent[i];
+        uint32 reagentCount = spellInfo->ReagentCount[i];
+        if (reagentEntry <= 0 || reagentCount == 0)
+            continue;
+
+        uint32 playerHas = data->inventory.GetItemCount(player, reagentEntry);
+        uint32 vaultHas = GetItemCount(accountId, reagentEntry);
+
+        if (playerHas + vaultHas < reagentCount)
+            return ABYSSAL_ERR_MISSING_REAGENTS;
+
+        ItemTemplate const* tmpl = sObjectMgr->GetItemTemplate(reagentEntry);
+        uint32 maxStack = tmpl ? tmpl->GetMaxStackSize() : 1;
+
+        reagents.push_back({ reagentEntry, reagentCount, playerHas, vaultHas, maxStack });
+    }
+
+    uint32 freeSlots = data->inventory.GetFreeSlots(player);
+
+    // Count how many distinct reagents need vault withdrawal
+    uint32 vaultReagentSlots = 0;
+    for (auto const& r : reagents)
+    {
+        if (r.playerHas < r.perCraft)
+            vaultReagentSlots++;
+    }
+
+    // Need: 1 slot per vault reagent type + 1 for the crafted product
+    if (freeSlots < vaultReagentSlots + 1)
+        return ABYSSAL_ERR_BAG_FULL;
+
+    // Cap craft count by total available reagents (inventory + vault)
+    uint32 maxCrafts = craftCount;
+    for (auto const& r : reagents)
+    {
+        uint32 possible = (r.playerHas + r.vaultHas) / r.perCraft;
+        maxCrafts = std::min(maxCrafts, possible);
+    }
+
+    // Cap further: each vault reagent gets at most 1 max-stack of bag space,
+    // so the amount we can withdraw is limited
+    for (auto const& r : reagents)
+    {
+        if (r.playerHas >= r.perCraft * maxCrafts)
+            continue; // inventory alone covers this reagent for maxCrafts
+
+        // Available in bags = what player already has + up to 1 max stack from vault
+        uint32 availableInBags = r.playerHas + std::min(r.vaultHas, r.maxStack);
+        uint32 possible = availableInBags / r.perCraft;
+        maxCrafts = std::min(maxCrafts, possible);
+    }
+
+    if (maxCrafts == 0)
+        return ABYSSAL_ERR_MISSING_REAGENTS;
+
+    craftCount = std::min(craftCount, maxCrafts);
+
+    data->isMaterializing = true;
+
+    // Materialize reagents needed for craftCount crafts (at most 1 stack per type)
+    for (auto const& r : reagents)
+    {
+        uint32 totalNeeded = r.perCraft * craftCount;
+        if (r.playerHas >= totalNeeded)
+            continue;
+
+        uint32 deficit = totalNeeded - r.playerHas;
+        uint32 toWithdraw = std::min(deficit, r.vaultHas);
+        if (toWithdraw == 0)
+            continue;
+
+        ItemPosCountVec dest;
+        InventoryResult invResult = player->CanStoreNewItem(NULL_BAG, NULL_SLOT, dest, r.entry, toWithdraw);
+        if (invResult != EQUIP_ERR_OK)
+        {
+            if (data)
+                data->isMaterializing = false;
+            return ABYSSAL_ERR_BAG_FULL;
+        }
+
+        if (!WithdrawItem(accountId, r.entry, toWithdraw))
+        {
+            if (data)
+                data->isMaterializing = false;
+            SendItemUpdate(player, r.entry, GetItemCount(accountId, r.entry));
+            return ABYSSAL_ERR_MISSING_REAGENTS;
+        }
+
+        Item* newItem = player->StoreNewItem(dest, r.entry, true);
+        if (!newItem)
+            DepositItem(accountId, r.entry, toWithdraw);
+        else if (data)
+            data->materializedItems.insert(newItem->GetGUID().GetCounter());
+
+        SendItemUpdate(player, r.entry, GetItemCount(accountId, r.entry));
+    }
+
+    if (data)
+    {
+        data->isMaterializing = false;
+        data->autoStoreEnabled = false; // prevent re-deposit of withdrawn reagents
+        data->pendingCrafts = craftCount;  // OnSpellCast will decrement and re-cast
+        data->pendingSpellId = spellId;
+    }
+
+    // Cast once — OnSpellCast will chain the remaining crafts
+    player->CastSpell(player, spellId, false);
+
+    crafts = craftCount;
+    return ABYSSAL_OK;
+}
+
+// Replies with CRAFT:spellId,maxCrafts;... for every known recipe of the skill
+// line, counting inventory + vault. Each reagent total is looked up only once.
+void AbyssalStorageMgr::SendCraftableCounts(Player* player, uint32 skillId)
+{
+    uint32 accountId = player->GetSession()->GetAccountId();
+    AbyssalInventoryIndex& inventory = GetAbyssalData(player)->inventory;
+    inventory.Invalidate();
+
+    // Recipes of the skill line first, so a lazily loaded vault can fetch every reagent row at once
+    std::vector<SpellInfo const*> recipes;
+    std::vector<uint32> reagentEntries;
+    for (auto const& [spellId, playerSpell] : player->GetSpellMap())
+    {
+        if (playerSpell->State == PLAYERSPELL_REMOVED || !playerSpell->Active)
+            continue;
+
+        bool inSkill = false;
+        SkillLineAbilityMapBounds bounds = sSpellMgr->GetSkillLineAbilityMapBounds(spellId);
+        for (auto itr = bounds.first; itr != bounds.second; ++itr)
+        {
+            if (itr->second->SkillLine == skillId)
+            {
+                inSkill = true;
+                break;
+            }
+        }
+
+        if (!inSkill)
+            continue;
+
+        SpellInfo const* spellInfo = sSpellMgr->GetSpellInfo(spellId);
+        if (!spellInfo)
+            continue;
+
+        bool hasReagents = false;
+        for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+        {
+            if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0)
+            {
+                hasReagents = true;
+                reagentEntries.push_back(spellInfo->Reagent[i]);
+            }
+        }
+
+        if (hasReagents)
+            recipes.push_back(spellInfo);
+    }
+
+    EnsureResident(accountId, reagentEntries);
+
+    std::unordered_map<uint32, uint32> totals; // reagent entry -> inventory + vault
+    auto getTotal = [&](uint32 entry)
+    {
+        auto [itr, inserted] = totals.try_emplace(entry, 0);
+        if (inserted)
+            itr->second = inventory.GetItemCount(player, entry) + GetItemCount(accountId, entry);
+        return itr->second;
+    };
+
+    std::string msg = "CRAFT:";
+    bool first = true;
+
+    for (SpellInfo const* spellInfo : recipes)
+    {
+        uint32 maxCrafts = std::numeric_limits<uint32>::max();
+        for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+        {
+            int32 reagentEntry = spellInfo->Reagent[i];
+            uint32 reagentCount = spellInfo->ReagentCount[i];
+            if (reagentEntry <= 0 || reagentCount == 0)
+                continue;
+
+            maxCrafts = std::min(maxCrafts, getTotal(reagentEntry) / reagentCount);
+        }
+
+        if (!first)
+            msg += ";";
+        msg += std::to_string(spellInfo->Id) + "," + std::to_string(maxCrafts);
+        first = false;
+    }
+
+    SendAddonMessage(player, msg);
+}
+
+// ============================================================================
+// Addon Request Channel
+// ============================================================================
+//
+// The addon whispers itself "ABYS\tREQ:<id>:<op>[;<op>...]" where each op is
+//   W <itemEntry> <count>   withdraw (count 0 = all)
+//   D                       deposit all eligible inventory items
+//   S                       full sync
+//   M                       move mail attachments into the vault
+//   C <spellId> <count>     craft with vault reagents
+//   K <skillLineId>         craftable counts for a profession
+//   P <sort> <offset> <limit> [class [subclass]]
+//                           one page of the vault (PAGE:), data = size of the range
+//   G                       entries per class/subclass (CATS:), data = category count
+//   F <limit> <text>        vault items whose name contains text (FIND:), data = match count
+// Every op gets exactly one reply, in order:
+//   ACK:<id>:<opIndex>:<data>    or    ERR:<id>:<opIndex>:<code>
+
+static constexpr std::size_t MAX_REQUEST_OPS = 16;
+
+void AbyssalStorageMgr::SendRequestReply(Player* player, uint32 requestId, uint32 opIndex, AbyssalResult result, uint32 data)
+{
+    if (result == ABYSSAL_OK)
+        SendAddonMessage(player, "ACK:" + std::to_string(requestId) + ":" + std::to_string(opIndex) + ":" + std::to_string(data));
+    else
+        SendAddonMessage(player, "ERR:" + std::to_string(requestId) + ":" + std::to_string(opIndex) + ":" + GetAbyssalResultCode(result));
+}
+
+AbyssalResult AbyssalStorageMgr::HandleRequestOp(Player* player, std::string_view op, uint32& data)
+{
+    data = 0;
+
+    std::vector<std::string_view> args = Acore::Tokenize(op, ' ', false);
+    if (args.empty() || args[0].size() != 1)
+        return ABYSSAL_ERR_BAD_REQUEST;
+
+    auto argAt = [&args](std::size_t i) -> Optional<uint32>
+    {
+        if (i >= args.size())
+            return {};
+        return Acore::StringTo<uint32>(args[i]);
+    };
+
+    switch (args[0][0])
+    {
+        case 'W':
+        {
+            Optional<uint32> entry = argAt(1);
+            if (!entry)
+                return ABYSSAL_ERR_BAD_REQUEST;
+            sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), *entry, argAt(2).value_or(0), ABYSSAL_TRACE_CMD_WITHDRAW);
+            return WithdrawToInventory(player, *entry, argAt(2).value_or(0), data);
+        }
+        case 'D':
+            sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), 0, 0, ABYSSAL_TRACE_CMD_DEPOSIT);
+            return DepositInventory(player, data);
+        case 'S':
+            sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), 0, 0, ABYSSAL_TRACE_CMD_SYNC);
+            QueueFullSync(player);
+            return ABYSSAL_OK;
+        case 'M':
+        {
+            uint32 itemTypes;
+            sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), 0, 0, ABYSSAL_TRACE_CMD_MAIL);
+            return TakeMailToVault(player, data, itemTypes);
+        }
+        case 'C':
+        {
+            Optional<uint32> spellId = argAt(1);
+            if (!spellId)
+                return ABYSSAL_ERR_BAD_REQUEST;
+            sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), *spellId, argAt(2).value_or(1), ABYSSAL_TRACE_CMD_CRAFT);
+            return StartCraft(player, *spellId, argAt(2).value_or(1), data);
+        }
+        case 'K':
+        {
+            Optional<uint32> skillId = argAt(1);
+            if (!skillId)
+                return ABYSSAL_ERR_BAD_REQUEST;
+            sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), *skillId, 0, ABYSSAL_TRACE_CMD_CRAFTABLE);
+            SendCraftableCounts(player, *skillId);
+            return ABYSSAL_OK;
+        }
+        case 'P':
+        {
+            Optional<uint32> sort = argAt(1);
+            Optional<uint32> offset = argAt(2);
+            Optional<uint32> limit = argAt(3);
+            if (!sort || *sort >= MAX_ABYSSAL_SORT || !offset || !limit)
+                return ABYSSAL_ERR_BAD_REQUEST;
+
+            Optional<uint32> itemClass = argAt(4);
+            Optional<uint32> itemSubClass = argAt(5);
+            SendVaultPage(player, itemClass ? int32(*itemClass) : -1, itemSubClass ? int32(*itemSubClass) : -1,
+                AbyssalBrowseSort(*sort), *offset, *limit, data);
+            return ABYSSAL_OK;
+        }
+        case 'G':
+            data = SendCategoryCounts(player);
+            return ABYSSAL_OK;
+        case 'F':
+        {
+            // The search text is the rest of the op and may itself contain spaces
+            Optional<uint32> limit = argAt(1);
+            if (!limit || args.size() < 3)
+                return ABYSSAL_ERR_BAD_REQUEST;
+            data = SendSearchResults(player, op.substr(args[2].data() - op.data()), *limit);
+            return ABYSSAL_OK;
+        }
+        default:
+            return ABYSSAL_ERR_BAD_REQUEST;
+    }
+}
+
+bool AbyssalStorageMgr::HandleAddonRequest(Player* player, std::string_view message)
+{
+    // Only our own prefix — everything else is left to the normal chat path
+    constexpr std::string_view prefix = "ABYS\tREQ:";
+    if (message.substr(0, prefix.size()) != prefix)
+        return false;
+
+    std::string_view body = message.substr(prefix.size());
+    std::size_t idEnd = body.find(':');
+    Optional<uint32> requestId = Acore::StringTo<uint32>(body.substr(0, idEnd));
+    if (!requestId || idEnd == std::string_view::npos)
+        return true; // malformed, but still ours — swallow it
+
+    std::vector<std::string_view> ops = Acore::Tokenize(body.substr(idEnd + 1), ';', false);
+
+    for (std::size_t i = 0; i < ops.size(); ++i)
+    {
+        uint32 data = 0;
+        AbyssalResult result = ABYSSAL_ERR_BAD_REQUEST;
+        if (!IsEnabled())
+            result = ABYSSAL_ERR_DISABLED;
+        else if (i < MAX_REQUEST_OPS)
+            result = HandleRequestOp(player, ops[i], data);
+
+        SendRequestReply(player, *requestId, i, result, data);
+    }
+
+    return true;
+}
@@ -0,0 +1,262 @@
+#include "AbyssalStorage.h"
+#include "DatabaseEnv.h"
+#include "GameTime.h"
+#include "Log.h"
+#include "World.h"
+
+// ============================================================================
+// Lazy loading
+// ============================================================================
+//
+// With AbyssalStorage.LazyLoad.Enable an account load reads only the list of
+// entries it holds. A row is fetched the first time something needs its count,
+// and callers that know a whole set up front (recipe reagents, quest items) fetch
+// it with one IN (...) query. Rows unused for EvictAfter seconds are dropped from
+// the cache again; only a full SYNC brings in every row. Any row we write to is
+// resident, so a fetch never replaces a cached count with an older DB value.
+
+static constexpr uint32 EVICT_SWEEP_INTERVAL = 60 * 1000;
+static constexpr uint32 SESSION_SWEEP_INTERVAL = 5 * 1000;
+
+void AbyssalStorageMgr::SetLazyLoad(bool enabled, uint32 evictAfterSecs)
+{
+    _lazyLoad = enabled;
+    _evictAfterSecs = std::max<uint32>(evictAfterSecs, 60);
+}
+
+void AbyssalStorageMgr::SetEntryPresent(uint32 accountId, uint32 itemEntry, bool present)
+{
+    auto resIt = _residency.find(accountId);
+    if (resIt != _residency.end())
+    {
+        if (present)
+            resIt->second.known.insert(itemEntry);
+        else
+            resIt->second.known.erase(itemEntry);
+    }
+
+    UpdateBrowseIndex(accountId, itemEntry, present);
+    InvalidateSyncCache(accountId);
+}
+
+void AbyssalStorageMgr::EnsureResident(uint32 accountId, std::span<uint32 const> itemEntries)
+{
+    if (!_lazyLoad)
+        return;
+
+    std::vector<uint32> missing;
+    {
+        std::lock_guard<std::mutex> lock(_storageMutex);
+
+        auto resIt = _residency.find(accountId);
+        auto accIt = _storage.find(accountId);
+        if (resIt == _residency.end() || resIt->second.complete || accIt == _storage.end())
+            return;
+
+        for (uint32 itemEntry : itemEntries)
+        {
+            if (!accIt->second.count(itemEntry) && resIt->second.known.count(itemEntry))
+                missing.push_back(itemEntry);
+        }
+    }
+
+    if (missing.empty())
+        return;
+
+    std::string entryList;
+    for (uint32 itemEntry : missing)
+    {
+        if (!entryList.empty())
+            entryList += ",";
+        entryList += std::to_string(itemEntry);
+    }
+
+    QueryResult result = CharacterDatabase.Query("SELECT item_entry, count, version FROM abyssal_storage "
+        "WHERE account_id = {} AND item_entry IN ({}) AND count > 0", accountId, entryList);
+
+    uint32 now = uint32(GameTime::GetGameTime().count());
+
+    std::lock_guard<std::mutex> lock(_storageMutex);
+
+    auto accIt = _storage.find(accountId);
+    if (accIt == _storage.end())
+        return;
+
+    if (result)
+    {
+        do
+        {
+            Field* fields = result->Fetch();
+            // try_emplace: a row written while we were querying is newer than what we read
+            accIt->second.try_emplace(fields[0].Get<uint32>(), AbyssalVaultEntry{ fields[1].Get<uint32>(), fields[2].Get<uint32>(), now });
+        } while (result->NextRow());
+    }
+
+    // Known entries without a row were emptied by another process
+    for (uint32 itemEntry : missing)
+    {
+        if (!accIt->second.count(itemEntry))
+            SetEntryPresent(accountId, itemEntry, false);
+    }
+}
+
+void AbyssalStorageMgr::EnsureFullyLoaded(uint32 accountId)
+{
+    if (!_lazyLoad)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_storageMutex);
+        auto resIt = _residency.find(accountId);
+        if (resIt == _residency.end() || resIt->second.complete)
+            return;
+    }
+
+    uint32 startTime = getMSTime();
+    QueryResult result = CharacterDatabase.Query("SELECT item_entry, count, version FROM abyssal_storage WHERE account_id = {} AND count > 0", accountId);
+
+    uint32 now = uint32(GameTime::GetGameTime().count());
+
+    std::lock_guard<std::mutex> lock(_storageMutex);
+
+    auto resIt = _residency.find(accountId);
+    auto accIt = _storage.find(accountId);
+    if (resIt == _residency.end() || accIt == _storage.end())
+        return;
+
+    if (result)
+    {
+        do
+        {
+            Field* fields = result->Fetch();
+            uint32 itemEntry = fields[0].Get<uint32>();
+            if (accIt->second.try_emplace(itemEntry, AbyssalVaultEntry{ fields[1].Get<uint32>(), fields[2].Get<uint32>(), now }).second)
+                SetEntryPresent(accountId, itemEntry, true);
+        } while (result->NextRow());
+    }
+
+    std::vector<uint32> gone;
+    for (uint32 itemEntry : resIt->second.known)
+    {
+        if (!accIt->second.count(itemEntry))
+            gone.push_back(itemEntry);
+    }
+    for (uint32 itemEntry : gone)
+        SetEntryPresent(accountId, itemEntry, false);
+
+    resIt->second.complete = true;
+
+    LOG_DEBUG("module", "AbyssalStorage: fully loaded account {} ({} entries) in {} ms", accountId, accIt->second.size(), GetMSTimeDiffToNow(startTime));
+}
+
+void AbyssalStorageMgr::UpdateResidency(uint32 diff)
+{
+    if (!_lazyLoad)
+        return;
+
+    _evictTimer += diff;
+    if (_evictTimer < EVICT_SWEEP_INTERVAL)
+        return;
+    _evictTimer = 0;
+
+    uint32 cutoff = uint32(GameTime::GetGameTime().count()) - _evictAfterSecs;
+    uint32 evicted = 0;
+
+    std::lock_guard<std::mutex> lock(_storageMutex);
+    for (auto& [accountId, residency] : _residency)
+    {
+        auto accIt = _storage.find(accountId);
+        if (accIt == _storage.end())
+            continue;
+
+        for (auto itr = accIt->second.begin(); itr != accIt->second.end();)
+        {
+            if (itr->second.lastUsed < cutoff)
+            {
+                itr = accIt->second.erase(itr);
+                residency.complete = false;
+                ++evicted;
+            }
+            else
+                ++itr;
+        }
+    }
+
+    if (evicted)
+        LOG_DEBUG("module", "AbyssalStorage: evicted {} cold vault rows", evicted);
+}
+
+// ============================================================================
+// Account prefetch
+// ============================================================================
+//
+// The account is known as soon as its session authenticates, well before a
+// character enters the world. OnAccountLogin queues the account, and the next
+// world tick reads its vault with an async query, so OnPlayerLogin normally
+// finds it cached. A result that arrives after the session has gone is dropped.
+// If the character logs in first, LoadAccountData reads it synchronously as before
+// and the late result is discarded. Accounts stay cached from then until the
+// session ends, not just until the character logs out.
+
+void AbyssalStorageMgr::PrefetchAccountData(uint32 accountId)
+{
+    std::lock_guard<std::mutex> guard(_prefetchMutex);
+    _prefetchQueue.push_back(accountId);
+}
+
+void AbyssalStorageMgr::ReleaseAccountData(uint32 accountId)
+{
+    _sessionAccounts.insert(accountId);
+}
+
+void AbyssalStorageMgr::GetPrefetchStats(uint64& issued, uint64& abandoned, uint32& sessionAccounts)
+{
+    issued = _prefetchesIssued;
+    abandoned = _prefetchesAbandoned;
+    sessionAccounts = _sessionAccounts.size();
+}
+
+void AbyssalStorageMgr::UpdatePrefetches(uint32 diff)
+{
+    std::vector<uint32> accounts;
+    {
+        std::lock_guard<std::mutex> guard(_prefetchMutex);
+        accounts.swap(_prefetchQueue);
+    }
+
+    for (uint32 accountId : accounts)
+    {
+        if (IsAccountLoaded(accountId))
+            continue;
+
+        ++_prefetchesIssued;
+        _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery(GetAccountLoadQuery(accountId))
+            .WithCallback([this, accountId](QueryResult result)
+        {
+            if (!sWorld->FindSession(accountId))
+            {
+                ++_prefetchesAbandoned;
+                return;
+            }
+
+            InstallAccountData(accountId, std::move(result));
+            _sessionAccounts.insert(accountId);
+        }));
+    }
+
+    _sessionSweepTimer += diff;
+    if (_sessionSweepTimer < SESSION_SWEEP_INTERVAL)
+        return;
+    _sessionSweepTimer = 0;
+
+    for (auto itr = _sessionAccounts.begin(); itr != _sessionAccounts.end();)
+    {
+        if (!sWorld->FindSession(*itr))
+        {
+            UnloadAccountData(*itr);
+            itr = _sessionAccounts.erase(itr);
+        }
+        else
+            ++itr;
+    }
+}
@@ -0,0 +1,197 @@
+#include "AbyssalStorage.h"
+#include "DatabaseEnv.h"
+#include "ObjectAccessor.h"
+#include "Player.h"
+#include "WorldSession.h"
+#include <chrono>
+
+// ============================================================================
+// Tick-budgeted work
+// ============================================================================
+//
+// Deposit flushes and full SYNCs are queued here instead of running in the hook
+// that asked for them, so a raid clear or a login wave can't pile them all into
+// one world tick. Each tick drains the queues in priority order until
+// AbyssalStorage.Scheduler.TickBudget microseconds are spent and leaves the rest
+// for the next tick. Critical work runs regardless of the budget. Work that must
+// happen before the Player goes away (logout re-vault, logout flush) or before
+// the next cast sees the bags (re-vault after a craft) still runs inline.
+
+void AbyssalStorageMgr::SetTickBudget(uint32 budgetUs)
+{
+    std::lock_guard<std::mutex> guard(_workMutex);
+    _tickBudgetUs = budgetUs;
+}
+
+void AbyssalStorageMgr::QueueWork(AbyssalWorkPriority priority, ObjectGuid playerGuid, AbyssalWorkType type)
+{
+    std::lock_guard<std::mutex> guard(_workMutex);
+    _workQueues[priority].push_back({ playerGuid, type });
+
+    uint32 queued = 0;
+    for (auto const& queue : _workQueues)
+        queued += queue.size();
+    _maxQueued = std::max(_maxQueued, queued);
+}
+
+void AbyssalStorageMgr::QueueFullSync(Player* player)
+{
+    AbyssalPlayerData* data = GetAbyssalData(player);
+    if (data)
+    {
+        if (data->syncQueued)
+            return;
+        data->syncQueued = true;
+    }
+
+    QueueWork(ABYSSAL_WORK_SYNC, player->GetGUID(), ABYSSAL_WORK_SEND_SYNC);
+}
+
+void AbyssalStorageMgr::FlushPendingDeposits(Player* player, AbyssalPlayerData* data)
+{
+    // Swap the buffers so deposits queued by hooks during the flush land in the other one
+    std::swap(data->pendingDeposits, data->flushingDeposits);
+
+    data->inventory.Invalidate();
+
+    uint32 accountId = player->GetSession()->GetAccountId();
+
+    // One DB transaction for everything looted since the last flush
+    CharacterDatabaseTransaction trans;
+
+    for (auto const& dep : data->flushingDeposits)
+    {
+        // Verify the player still has the items (they may have been used/moved)
+        uint32 playerHas = data->inventory.GetItemCount(player, dep.itemEntry);
+        uint32 toDeposit = std::min(dep.count, playerHas);
+        if (toDeposit == 0)
+            continue;
+
+        // Never deposit below the quest-required threshold — guards against
+        // timing races where item->GetCount() or quest status was stale when queued
+        uint32 questReserved = GetQuestReservedCount(player, dep.itemEntry);
+        if (playerHas <= questReserved)
+            continue;
+        toDeposit = std::min(toDeposit, playerHas - questReserved);
+
+        if (!trans)
+            trans = CharacterDatabase.BeginTransaction();
+        // Whatever a full vault count can't take stays in the bags
+        toDeposit = DepositItem(accountId, dep.itemEntry, toDeposit, trans);
+        if (!toDeposit)
+            continue;
+
+        player->DestroyItemCount(dep.itemEntry, toDeposit, true);
+        data->inventory.OnDestroyed(dep.itemEntry, toDeposit);
+
+        uint32 newTotal = GetItemCount(accountId, dep.itemEntry);
+        SendItemUpdate(player, dep.itemEntry, newTotal);
+    }
+
+    if (trans)
+        CommitVaultTransaction(trans);
+
+    data->flushingDeposits.clear();
+}
+
+static void RunWork(Player* player, AbyssalWorkType type)
+{
+    AbyssalPlayerData* data = GetAbyssalData(player);
+
+    switch (type)
+    {
+        case ABYSSAL_WORK_FLUSH_DEPOSITS:
+            if (data)
+            {
+                data->flushQueued = false;
+                if (!data->pendingDeposits.empty())
+                    sAbyssalStorageMgr->FlushPendingDeposits(player, data);
+            }
+            break;
+        case ABYSSAL_WORK_SEND_SYNC:
+            if (data)
+                data->syncQueued = false;
+            sAbyssalStorageMgr->SendFullSync(player);
+            break;
+    }
+}
+
+void AbyssalStorageMgr::GetSchedulerStats(AbyssalSchedulerStats& stats)
+{
+    std::lock_guard<std::mutex> guard(_workMutex);
+    stats.budgetUs = _tickBudgetUs;
+    for (uint8 priority = 0; priority < MAX_ABYSSAL_WORK_PRIORITY; ++priority)
+        stats.queued[priority] = _workQueues[priority].size();
+    stats.maxQueued = _maxQueued;
+    stats.executed = _workExecuted;
+    stats.carried = _budgetCarries;
+    stats.overruns = _budgetOverruns;
+    stats.lastTickUs = _lastTickUs;
+}
+
+void AbyssalStorageMgr::RunScheduledWork()
+{
+    auto start = std::chrono::steady_clock::now();
+    auto elapsedUs = [&start]()
+    {
+        return uint32(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    };
+
+    // Players between maps keep their place until they are back in the world
+    _waitingWork.clear();
+    bool outOfBudget = false;
+    uint64 executed = 0;
+
+    for (uint8 priority = 0; priority < MAX_ABYSSAL_WORK_PRIORITY && !outOfBudget; ++priority)
+    {
+        while (true)
+        {
+            AbyssalScheduledWork work;
+            {
+                std::lock_guard<std::mutex> guard(_workMutex);
+                if (_workQueues[priority].empty())
+                    break;
+
+                if (priority != ABYSSAL_WORK_CRITICAL && _tickBudgetUs && elapsedUs() >= _tickBudgetUs)
+                {
+                    outOfBudget = true;
+                    break;
+                }
+
+                work = _workQueues[priority].front();
+                _workQueues[priority].pop_front();
+            }
+
+            // Nothing is lost by dropping work for a player who has logged out.
+            // OnPlayerLogout runs while the player is still findable and flushes the
+            // pending deposits inline, and a SYNC has no one left to go to. The
+            // flushQueued/syncQueued flags went away with the player's data.
+            Player* player = ObjectAccessor::FindConnectedPlayer(work.playerGuid);
+            if (!player)
+                continue;
+
+            if (!player->IsInWorld())
+            {
+                _waitingWork.emplace_back(priority, work);
+                continue;
+            }
+
+            RunWork(player, work.type);
+            ++executed;
+        }
+    }
+
+    uint32 tickUs = elapsedUs();
+
+    std::lock_guard<std::mutex> guard(_workMutex);
+    for (auto itr = _waitingWork.rbegin(); itr != _waitingWork.rend(); ++itr)
+        _workQueues[itr->first].push_front(itr->second);
+
+    _workExecuted += executed;
+    _lastTickUs = tickUs;
+    _workBacklogged = outOfBudget;
+    if (outOfBudget)
+        ++_budgetCarries;
+    if (_tickBudgetUs && tickUs > _tickBudgetUs)
+        ++_budgetOverruns;
+}
@@ -1,9 +1,11 @@
 #include "AbyssalStorage.h"
+#include "AbyssalStorageTrace.h"
 #include "Chat.h"
 #include "ChatCommand.h"
 #include "Config.h"
 #include "DatabaseEnv.h"
 #include "Item.h"
+#include "Log.h"
 #include "ObjectMgr.h"
 #include "Player.h"
 #include "QuestDef.h"
@@ -11,6 +13,8 @@
 #include "Spell.h"
 #include "SpellInfo.h"
 #include "SpellMgr.h"
+#include "StringConvert.h"
+#include "Tokenize.h"
 #include "WorldPacket.h"
 #include "WorldSession.h"
 #include <sstream>
@@ -31,7 +35,7 @@ static std::string BuildItemLink(uint32 itemEntry)
 }
 
 // ============================================================================
-// WorldScript — Config Loading
+// WorldScript — Config Loading, World Tick
 // ============================================================================
 
 class AbyssalStorageWorldScript : public WorldScript
@@ -39,9 +43,69 @@ class AbyssalStorageWorldScript : public WorldScript
 public:
     AbyssalStorageWorldScript() : WorldScript("AbyssalStorageWorldScript") { }
 
-    void OnAfterConfigLoad(bool /*reload*/) override
+    void OnAfterConfigLoad(bool reload) override
     {
         sAbyssalStorageMgr->SetEnabled(sConfigMgr->GetOption<bool>("AbyssalStorage.Enable", true));
+        sAbyssalStorageMgr->SetCoherence(
+            sConfigMgr->GetOption<bool>("AbyssalStorage.Coherence.Enable", false),
+            sConfigMgr->GetOption<uint16>("AbyssalStorage.Coherence.NodeId", 0),
+            sConfigMgr->GetOption<uint32>("AbyssalStorage.Coherence.PollInterval", 1000),
+            sConfigMgr->GetOption<uint32>("AbyssalStorage.Coherence.ChangeRetention", 3600));
+        // Residency mode can't change under already loaded accounts
+        if (!reload)
+            sAbyssalStorageMgr->SetLazyLoad(
+                sConfigMgr->GetOption<bool>("AbyssalStorage.LazyLoad.Enable", false),
+                sConfigMgr->GetOption<uint32>("AbyssalStorage.LazyLoad.EvictAfter", 600));
+        sAbyssalStorageMgr->SetTotalsFlushInterval(sConfigMgr->GetOption<uint32>("AbyssalStorage.Totals.FlushInterval", 60));
+        sAbyssalStorageMgr->SetTickBudget(sConfigMgr->GetOption<uint32>("AbyssalStorage.Scheduler.TickBudget", 2000));
+        sAbyssalStorageMgr->SetSnapshotDirectory(sConfigMgr->GetOption<std::string>("AbyssalStorage.Snapshot.Directory", ""));
+
+        if (sConfigMgr->GetOption<bool>("AbyssalStorage.Trace.Enable", false))
+        {
+            std::string error;
+            if (!sAbyssalTrace->IsRecording() && !sAbyssalTrace->Start(sConfigMgr->GetOption<std::string>("AbyssalStorage.Trace.File", "abyssal_storage.trace"), error))
+                LOG_ERROR("module", "AbyssalStorage: hook trace not started: {}", error);
+        }
+        else
+            sAbyssalTrace->Stop();
+    }
+
+    void OnStartup() override
+    {
+        sAbyssalStorageMgr->LoadRealmTotals();
+        sAbyssalStorageMgr->BuildNameIndex();
+    }
+
+    void OnUpdate(uint32 diff) override
+    {
+        sAbyssalStorageMgr->Update(diff);
+        sAbyssalTrace->Update(diff);
+    }
+
+    void OnShutdown() override
+    {
+        StopAbyssalTraceReplay();
+        sAbyssalStorageMgr->SaveRealmTotals();
+        sAbyssalTrace->Stop();
+    }
+};
+
+// ============================================================================
+// AccountScript — Vault Prefetch
+// ============================================================================
+
+class AbyssalStorageAccountScript : public AccountScript
+{
+public:
+    AbyssalStorageAccountScript() : AccountScript("AbyssalStorageAccountScript", {
+        ACCOUNTHOOK_ON_ACCOUNT_LOGIN
+    }) { }
+
+    // Called from the network thread once the session has authenticated
+    void OnAccountLogin(uint32 accountId) override
+    {
+        if (sAbyssalStorageMgr->IsEnabled())
+            sAbyssalStorageMgr->PrefetchAccountData(accountId);
     }
 };
 
@@ -57,7 +121,9 @@ public:
         PLAYERHOOK_ON_LOGOUT,
         PLAYERHOOK_ON_UPDATE,
         PLAYERHOOK_ON_STORE_NEW_ITEM,
-        PLAYERHOOK_ON_BEFORE_QUEST_COMPLETE
+        PLAYERHOOK_ON_BEFORE_QUEST_COMPLETE,
+        PLAYERHOOK_CAN_PLAYER_USE_PRIVATE_CHAT,
+        PLAYERHOOK_ON_BEFORE_BUY_ITEM_FROM_VENDOR
     }) { }
 
     void OnPlayerLogin(Player* player) override
@@ -66,8 +132,12 @@ public:
             return;
 
         uint32 accountId = player->GetSession()->GetAccountId();
+        sAbyssalTrace->Record(ABYSSAL_TRACE_LOGIN, accountId);
         sAbyssalStorageMgr->LoadAccountData(accountId);
-        sAbyssalStorageMgr->SendFullSync(player);
+
+        // Lazily loaded vaults stay partial until the addon asks for a SYNC
+        if (!sAbyssalStorageMgr->IsLazyLoad())
+            sAbyssalStorageMgr->QueueFullSync(player);
     }
 
     void OnPlayerLogout(Player* player) override
@@ -76,8 +146,14 @@ public:
             return;
 
         uint32 accountId = player->GetSession()->GetAccountId();
+        sAbyssalTrace->Record(ABYSSAL_TRACE_LOGOUT, accountId);
         AbyssalPlayerData* data = GetAbyssalData(player);
 
+        // A queued flush would find the player gone and be dropped, so loot from
+        // the last ticks goes in now (see RunScheduledWork)
+        if (data && !data->pendingDeposits.empty())
+            sAbyssalStorageMgr->FlushPendingDeposits(player, data);
+
         // Re-vault any materialized items still in inventory
         if (data && !data->materializedItems.empty())
         {
@@ -87,18 +163,15 @@ public:
                 if (item)
                 {
                     uint32 entry = item->GetEntry();
-                    uint32 count = item->GetCount();
-                    player->DestroyItemCount(entry, count, true);
-                    sAbyssalStorageMgr->DepositItem(accountId, entry, count);
+                    if (uint32 stored = sAbyssalStorageMgr->DepositItem(accountId, entry, item->GetCount()))
+                        player->DestroyItemCount(entry, stored, true);
                 }
             }
             data->materializedItems.clear();
         }
 
-        // Check if any other character on this account is online
-        // For simplicity, always unload — LoadAccountData will re-cache on next login
-        // A more efficient approach would reference-count, but this is safe
-        sAbyssalStorageMgr->UnloadAccountData(accountId);
+        // Stays cached for the next character until the session ends
+        sAbyssalStorageMgr->ReleaseAccountData(accountId);
     }
 
     void OnPlayerStoreNewItem(Player* player, Item* item, uint32 count) override
@@ -107,7 +180,17 @@ public:
             return;
 
         AbyssalPlayerData* data = GetAbyssalData(player);
-        if (!data || !data->autoStoreEnabled)
+        if (!data)
+            return;
+
+        // Our own materialization patches the index; anything else may follow
+        // destroys/moves we never saw, so the next read rebuilds it
+        if (data->isMaterializing)
+            data->inventory.OnStored(item->GetEntry(), count);
+        else
+            data->inventory.Invalidate();
+
+        if (!data->autoStoreEnabled)
             return;
 
         // Don't auto-store items being materialized from vault
@@ -115,7 +198,7 @@ public:
             return;
 
         // Don't auto-store materialized items
-        if (data->materializedItems.count(item->GetGUID().GetCounter()))
+        if (data->materializedItems.contains(item->GetGUID().GetCounter()))
             return;
 
         ItemTemplate const* itemTemplate = item->GetTemplate();
@@ -125,6 +208,7 @@ public:
         // Defer the deposit — destroying items inside this hook crashes the server
         // Use count (newly added) not item->GetCount() (merged stack size)
         data->pendingDeposits.push_back({ item->GetEntry(), count });
+        sAbyssalTrace->Record(ABYSSAL_TRACE_STORE_ITEM, player->GetSession()->GetAccountId(), item->GetEntry(), count);
     }
 
     void OnPlayerUpdate(Player* player, uint32 /*p_time*/) override
@@ -133,36 +217,38 @@ public:
             return;
 
         AbyssalPlayerData* data = GetAbyssalData(player);
-        if (!data || data->pendingDeposits.empty())
+        if (!data || data->pendingDeposits.empty() || data->flushQueued)
             return;
 
-        // Move pending list out so we don't re-enter if DestroyItemCount triggers hooks
-        std::vector<PendingDeposit> deposits = std::move(data->pendingDeposits);
-        data->pendingDeposits.clear();
-
-        uint32 accountId = player->GetSession()->GetAccountId();
+        // While flushes wait on the budget, nearly full bags go first so the next
+        // loot doesn't fail for lack of space. Otherwise the flush runs next tick
+        // anyway, and looting has just invalidated the index, so skip the bag walk.
+        data->flushQueued = true;
+        AbyssalWorkPriority priority = ABYSSAL_WORK_DEPOSIT;
+        if (sAbyssalStorageMgr->IsWorkBacklogged() && player->GetFreeInventorySpace() <= 2)
+            priority = ABYSSAL_WORK_CRITICAL;
+        sAbyssalStorageMgr->QueueWork(priority, player->GetGUID(), ABYSSAL_WORK_FLUSH_DEPOSITS);
+    }
 
-        for (auto const& dep : deposits)
-        {
-            // Verify the player still has the items (they may have been used/moved)
-            uint32 playerHas = player->GetItemCount(dep.itemEntry);
-            uint32 toDeposit = std::min(dep.count, playerHas);
-            if (toDeposit == 0)
-                continue;
+    // Eligible reagents bought with gold go straight into the vault. Clearing item
+    // tells Player::BuyItemFromVendorSlot the purchase was handled here.
+    void OnPlayerBeforeBuyItemFromVendor(Player* player, ObjectGuid vendorguid, uint32 vendorslot, uint32& item, uint8 count, uint8 /*bag*/, uint8 /*slot*/) override
+    {
+        if (!sAbyssalStorageMgr->IsEnabled() || !player || !item)
+            return;
 
-            // Never deposit below the quest-required threshold — guards against
-            // timing races where item->GetCount() or quest status was stale when queued
-            uint32 questReserved = sAbyssalStorageMgr->GetQuestReservedCount(player, dep.itemEntry);
-            if (playerHas <= questReserved)
-                continue;
-            toDeposit = std::min(toDeposit, playerHas - questReserved);
+        if (sAbyssalStorageMgr->BuyToVault(player, vendorguid, vendorslot, item, count))
+            item = 0;
+    }
 
-            player->DestroyItemCount(dep.itemEntry, toDeposit, true);
-            sAbyssalStorageMgr->DepositItem(accountId, dep.itemEntry, toDeposit);
+    // The addon whispers its requests to the player itself with LANG_ADDON;
+    // consume ours so they never reach the chat pipeline
+    bool OnPlayerCanUseChat(Player* player, uint32 type, uint32 language, std::string& msg, Player* receiver) override
+    {
+        if (type != CHAT_MSG_WHISPER || language != LANG_ADDON || receiver != player)
+            return true;
 
-            uint32 newTotal = sAbyssalStorageMgr->GetItemCount(accountId, dep.itemEntry);
-            sAbyssalStorageMgr->SendItemUpdate(player, dep.itemEntry, newTotal);
-        }
+        return !sAbyssalStorageMgr->HandleAddonRequest(player, msg);
     }
 
     bool OnPlayerBeforeQuestComplete(Player* player, uint32 questId) override
@@ -182,9 +268,21 @@ public:
             return true;
 
         uint32 accountId = player->GetSession()->GetAccountId();
+        sAbyssalTrace->Record(ABYSSAL_TRACE_QUEST_COMPLETE, accountId, questId);
+
+        std::vector<uint32> requiredEntries;
+        for (uint8 i = 0; i < QUEST_ITEM_OBJECTIVES_COUNT; ++i)
+        {
+            if (quest->RequiredItemId[i] && quest->RequiredItemCount[i])
+                requiredEntries.push_back(quest->RequiredItemId[i]);
+        }
+        sAbyssalStorageMgr->EnsureResident(accountId, requiredEntries);
 
         if (data)
+        {
+            data->inventory.Invalidate();
             data->isMaterializing = true;
+        }
 
         for (uint8 i = 0; i < QUEST_ITEM_OBJECTIVES_COUNT; ++i)
         {
@@ -193,7 +291,7 @@ public:
             if (!reqItem || !reqCount)
                 continue;
 
-            uint32 playerCount = player->GetItemCount(reqItem);
+            uint32 playerCount = data ? data->inventory.GetItemCount(player, reqItem) : player->GetItemCount(reqItem);
             if (playerCount >= reqCount)
                 continue;
 
@@ -212,11 +310,16 @@ public:
                 continue;
             }
 
-            Item* newItem = player->StoreNewItem(dest, reqItem, true);
-            if (newItem && data)
-                data->materializedItems.insert(newItem->GetGUID().GetCounter());
+            // Vault first, so a withdrawal lost to another worldserver creates nothing
+            if (sAbyssalStorageMgr->WithdrawItem(accountId, reqItem, toMaterialize))
+            {
+                Item* newItem = player->StoreNewItem(dest, reqItem, true);
+                if (!newItem)
+                    sAbyssalStorageMgr->DepositItem(accountId, reqItem, toMaterialize);
+                else if (data)
+                    data->materializedItems.insert(newItem->GetGUID().GetCounter());
+            }
 
-            sAbyssalStorageMgr->WithdrawItem(accountId, reqItem, toMaterialize);
             sAbyssalStorageMgr->SendItemUpdate(player, reqItem, sAbyssalStorageMgr->GetItemCount(accountId, reqItem));
         }
 
@@ -273,6 +376,17 @@ public:
         if (!data)
             return;
 
+        sAbyssalTrace->Record(ABYSSAL_TRACE_SPELL_CHECK, accountId, spellInfo->Id);
+        data->inventory.Invalidate();
+
+        std::vector<uint32> reagentEntries;
+        for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+        {
+            if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0)
+                reagentEntries.push_back(spellInfo->Reagent[i]);
+        }
+        sAbyssalStorageMgr->EnsureResident(accountId, reagentEntries);
+
         // First pass: verify vault can cover all deficits before materializing anything
         for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
         {
@@ -281,7 +395,7 @@ public:
             if (reagentEntry <= 0 || reagentCount == 0)
                 continue;
 
-            uint32 playerHas = player->GetItemCount(reagentEntry);
+            uint32 playerHas = data->inventory.GetItemCount(player, reagentEntry);
             if (playerHas >= reagentCount)
                 continue;
 
@@ -301,7 +415,7 @@ public:
             if (reagentEntry <= 0 || reagentCount == 0)
                 continue;
 
-            uint32 playerHas = player->GetItemCount(reagentEntry);
+            uint32 playerHas = data->inventory.GetItemCount(player, reagentEntry);
             if (playerHas >= reagentCount)
                 continue;
 
@@ -317,11 +431,21 @@ public:
                 return;
             }
 
+            // Vault first, so a withdrawal lost to another worldserver creates nothing
+            if (!sAbyssalStorageMgr->WithdrawItem(accountId, reagentEntry, deficit))
+            {
+                data->isMaterializing = false;
+                res = SPELL_FAILED_DONT_REPORT;
+                sAbyssalStorageMgr->SendItemUpdate(player, reagentEntry, sAbyssalStorageMgr->GetItemCount(accountId, reagentEntry));
+                ChatHandler(player->GetSession()).SendSysMessage("Abyssal Storage: Vault reagents changed, try again.");
+                return;
+            }
+
             Item* newItem = player->StoreNewItem(dest, reagentEntry, true);
-            if (newItem)
+            if (!newItem)
+                sAbyssalStorageMgr->DepositItem(accountId, reagentEntry, deficit);
+            else
                 data->materializedItems.insert(newItem->GetGUID().GetCounter());
-
-            sAbyssalStorageMgr->WithdrawItem(accountId, reagentEntry, deficit);
         }
         data->isMaterializing = false;
     }
@@ -361,9 +485,8 @@ public:
             if (item)
             {
                 uint32 entry = item->GetEntry();
-                uint32 count = item->GetCount();
-                player->DestroyItemCount(entry, count, true);
-                sAbyssalStorageMgr->DepositItem(accountId, entry, count);
+                if (uint32 stored = sAbyssalStorageMgr->DepositItem(accountId, entry, item->GetCount()))
+                    player->DestroyItemCount(entry, stored, true);
                 sAbyssalStorageMgr->SendItemUpdate(player, entry, sAbyssalStorageMgr->GetItemCount(accountId, entry));
             }
         }
@@ -388,12 +511,24 @@ public:
 
     ChatCommandTable GetCommands() const override
     {
+        static ChatCommandTable absAdminCommandTable =
+        {
+            { "export",   HandleExportCommand,     SEC_ADMINISTRATOR, Console::Yes },
+            { "import",   HandleImportCommand,     SEC_ADMINISTRATOR, Console::Yes },
+            { "top",      HandleTopCommand,        SEC_GAMEMASTER,    Console::Yes },
+            { "rebuildtotals", HandleRebuildTotalsCommand, SEC_ADMINISTRATOR, Console::Yes },
+            { "stats",    HandleStatsCommand,      SEC_GAMEMASTER,    Console::Yes },
+            { "replay",   HandleReplayCommand,     SEC_ADMINISTRATOR, Console::Yes },
+        };
         static ChatCommandTable absCommandTable =
         {
             { "withdraw", HandleWithdrawCommand,  SEC_PLAYER, Console::No },
             { "deposit",  HandleDepositCommand,   SEC_PLAYER, Console::No },
             { "sync",     HandleSyncCommand,      SEC_PLAYER, Console::No },
             { "craft",    HandleCraftCommand,      SEC_PLAYER, Console::No },
+            { "mail",     HandleMailCommand,       SEC_PLAYER, Console::No },
+            { "craftable", HandleCraftableCommand, SEC_PLAYER, Console::No },
+            { "admin",    absAdminCommandTable },
         };
         static ChatCommandTable commandTable =
         {
@@ -403,6 +538,23 @@ public:
         return commandTable;
     }
 
+    // Chat text for a failed operation
+    static char const* GetResultText(AbyssalResult result)
+    {
+        switch (result)
+        {
+            case ABYSSAL_ERR_NOT_IN_VAULT:     return "Abyssal Storage: Item not found in vault.";
+            case ABYSSAL_ERR_INVALID_ITEM:     return "Abyssal Storage: Invalid item.";
+            case ABYSSAL_ERR_INVALID_SPELL:    return "Abyssal Storage: Invalid spell.";
+            case ABYSSAL_ERR_NOT_CRAFTABLE:    return "Abyssal Storage: Spell has no reagents.";
+            case ABYSSAL_ERR_MISSING_REAGENTS: return "Abyssal Storage: Not enough reagents.";
+            case ABYSSAL_ERR_BAG_FULL:         return "Abyssal Storage: Not enough bag space.";
+            case ABYSSAL_ERR_NO_MAILBOX:       return "Abyssal Storage: You must be at a mailbox.";
+            case ABYSSAL_ERR_NOTHING_TO_DO:    return "Abyssal Storage: Nothing to do.";
+            default:                           return "Abyssal Storage: Request failed.";
+        }
+    }
+
     static bool HandleWithdrawCommand(ChatHandler* handler, uint32 itemEntry, Optional<uint32> optCount)
     {
         if (!sAbyssalStorageMgr->IsEnabled())
@@ -412,63 +564,17 @@ public:
         if (!player)
             return false;
 
-        uint32 accountId = player->GetSession()->GetAccountId();
-        uint32 vaultCount = sAbyssalStorageMgr->GetItemCount(accountId, itemEntry);
+        sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), itemEntry, optCount.value_or(0), ABYSSAL_TRACE_CMD_WITHDRAW);
 
-        if (vaultCount == 0)
+        uint32 withdrawn = 0;
+        AbyssalResult result = sAbyssalStorageMgr->WithdrawToInventory(player, itemEntry, optCount.value_or(0), withdrawn);
+        if (result != ABYSSAL_OK)
         {
-            handler->SendSysMessage("Abyssal Storage: Item not found in vault.");
+            handler->SendSysMessage(GetResultText(result));
             return true;
         }
 
-        uint32 count = optCount.value_or(vaultCount);
-        if (count > vaultCount)
-            count = vaultCount;
-
-        ItemTemplate const* itemTemplate = sObjectMgr->GetItemTemplate(itemEntry);
-        if (!itemTemplate)
-        {
-            handler->SendSysMessage("Abyssal Storage: Invalid item.");
-            return true;
-        }
-
-        // Disable auto-store BEFORE creating items, otherwise OnPlayerStoreNewItem
-        // will immediately re-deposit them back into the vault
-        AbyssalPlayerData* data = GetAbyssalData(player);
-        if (data)
-            data->autoStoreEnabled = false;
-
-        // Add items to player in stacks respecting max stack size
-        uint32 remaining = count;
-        while (remaining > 0)
-        {
-            uint32 stackSize = std::min(remaining, itemTemplate->GetMaxStackSize());
-
-            ItemPosCountVec dest;
-            InventoryResult result = player->CanStoreNewItem(NULL_BAG, NULL_SLOT, dest, itemEntry, stackSize);
-            if (result != EQUIP_ERR_OK)
-            {
-                handler->SendSysMessage("Abyssal Storage: Not enough bag space.");
-                break;
-            }
-
-            player->StoreNewItem(dest, itemEntry, true);
-            sAbyssalStorageMgr->WithdrawItem(accountId, itemEntry, stackSize);
-            remaining -= stackSize;
-        }
-
-        uint32 withdrawn = count - remaining;
-        if (withdrawn > 0)
-        {
-            uint32 newCount = sAbyssalStorageMgr->GetItemCount(accountId, itemEntry);
-            if (newCount > 0)
-                sAbyssalStorageMgr->SendItemUpdate(player, itemEntry, newCount);
-            else
-                sAbyssalStorageMgr->SendItemDelete(player, itemEntry);
-
-            handler->PSendSysMessage("Abyssal Storage: Withdrew {} x{}.", BuildItemLink(itemEntry), withdrawn);
-        }
-
+        handler->PSendSysMessage("Abyssal Storage: Withdrew {} x{}.", BuildItemLink(itemEntry), withdrawn);
         return true;
     }
 
@@ -481,53 +587,10 @@ public:
         if (!player)
             return false;
 
-        uint32 accountId = player->GetSession()->GetAccountId();
-
-        // Collect totals first — DestroyItemCount searches the whole inventory,
-        // so destroying during iteration can skip stacks of the same item
-        std::unordered_map<uint32, uint32> toDeposit; // itemEntry -> totalCount
-
-        for (uint8 bag = INVENTORY_SLOT_BAG_START; bag < INVENTORY_SLOT_BAG_END; ++bag)
-        {
-            if (Bag* pBag = player->GetBagByPos(bag))
-            {
-                for (uint8 slot = 0; slot < pBag->GetBagSize(); ++slot)
-                {
-                    Item* item = pBag->GetItemByPos(slot);
-                    if (!item)
-                        continue;
-
-                    if (sAbyssalStorageMgr->ShouldAutoStore(player, item->GetTemplate()))
-                        toDeposit[item->GetEntry()] += item->GetCount();
-                }
-            }
-        }
-
-        // Also scan the default backpack (slots 23-38)
-        for (uint8 slot = INVENTORY_SLOT_ITEM_START; slot < INVENTORY_SLOT_ITEM_END; ++slot)
-        {
-            Item* item = player->GetItemByPos(INVENTORY_SLOT_BAG_0, slot);
-            if (!item)
-                continue;
-
-            if (sAbyssalStorageMgr->ShouldAutoStore(player, item->GetTemplate()))
-                toDeposit[item->GetEntry()] += item->GetCount();
-        }
+        sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), 0, 0, ABYSSAL_TRACE_CMD_DEPOSIT);
 
-        // Now destroy and deposit in one pass per item entry
         uint32 depositedCount = 0;
-        for (auto const& [entry, count] : toDeposit)
-        {
-            player->DestroyItemCount(entry, count, true);
-            sAbyssalStorageMgr->DepositItem(accountId, entry, count);
-            ++depositedCount;
-        }
-
-        AbyssalPlayerData* data = GetAbyssalData(player);
-        if (data)
-            data->autoStoreEnabled = true;
-
-        sAbyssalStorageMgr->SendFullSync(player);
+        sAbyssalStorageMgr->DepositInventory(player, depositedCount);
         handler->PSendSysMessage("Abyssal Storage: Deposited {} item stacks.", depositedCount);
 
         return true;
@@ -542,14 +605,15 @@ public:
         if (!player)
             return false;
 
-        sAbyssalStorageMgr->SendFullSync(player);
-        handler->SendSysMessage("Abyssal Storage: Sync complete.");
+        sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), 0, 0, ABYSSAL_TRACE_CMD_SYNC);
+        sAbyssalStorageMgr->QueueFullSync(player);
+        handler->SendSysMessage("Abyssal Storage: Sync requested.");
         return true;
     }
 
-    // .abs craft <spellId> [count]
-    // Materializes reagents from vault and casts the crafting spell
-    static bool HandleCraftCommand(ChatHandler* handler, uint32 spellId, Optional<uint32> optCount)
+    // .abs mail
+    // Moves every vault-eligible mail attachment into the vault without touching bags
+    static bool HandleMailCommand(ChatHandler* handler)
     {
         if (!sAbyssalStorageMgr->IsEnabled())
             return false;
@@ -558,175 +622,205 @@ public:
         if (!player)
             return false;
 
-        SpellInfo const* spellInfo = sSpellMgr->GetSpellInfo(spellId);
-        if (!spellInfo)
-        {
-            handler->SendSysMessage("Abyssal Storage: Invalid spell.");
-            return true;
-        }
+        sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), 0, 0, ABYSSAL_TRACE_CMD_MAIL);
 
-        // Verify spell has reagents
-        bool hasReagents = false;
-        for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+        uint32 attachments = 0;
+        uint32 itemTypes = 0;
+        AbyssalResult result = sAbyssalStorageMgr->TakeMailToVault(player, attachments, itemTypes);
+        if (result == ABYSSAL_ERR_NOTHING_TO_DO)
         {
-            if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0)
-            {
-                hasReagents = true;
-                break;
-            }
+            handler->SendSysMessage("Abyssal Storage: No vault-eligible mail attachments.");
+            return true;
         }
-
-        if (!hasReagents)
+        if (result != ABYSSAL_OK)
         {
-            handler->SendSysMessage("Abyssal Storage: Spell has no reagents.");
+            handler->SendSysMessage(GetResultText(result));
             return true;
         }
 
-        uint32 accountId = player->GetSession()->GetAccountId();
-        uint32 craftCount = optCount.value_or(1);
-        if (craftCount == 0)
-            craftCount = 1;
-
-        // Gather reagent info: what the player has, what the vault has, per-craft need
-        struct ReagentInfo
-        {
-            int32  entry;
-            uint32 perCraft;
-            uint32 playerHas;
-            uint32 vaultHas;
-            uint32 maxStack;
-        };
-        std::vector<ReagentInfo> reagents;
-
-        for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
-        {
-            int32 reagentEntry = spellInfo->Reagent[i];
-            uint32 reagentCount = spellInfo->ReagentCount[i];
-            if (reagentEntry <= 0 || reagentCount == 0)
-                continue;
-
-            uint32 playerHas = player->GetItemCount(reagentEntry);
-            uint32 vaultHas = sAbyssalStorageMgr->GetItemCount(accountId, reagentEntry);
+        handler->PSendSysMessage("Abyssal Storage: Moved {} mail attachments ({} item types) to the vault.", attachments, itemTypes);
+        return true;
+    }
 
-            if (playerHas + vaultHas < reagentCount)
-            {
-                handler->SendSysMessage("Abyssal Storage: Not enough reagents.");
-                return true;
-            }
+    // .abs craftable <skillLineId>
+    // Replies with CRAFT:spellId,maxCrafts;... for every known recipe of the skill line
+    static bool HandleCraftableCommand(ChatHandler* handler, uint32 skillId)
+    {
+        if (!sAbyssalStorageMgr->IsEnabled())
+            return false;
 
-            ItemTemplate const* tmpl = sObjectMgr->GetItemTemplate(reagentEntry);
-            uint32 maxStack = tmpl ? tmpl->GetMaxStackSize() : 1;
+        Player* player = handler->GetSession()->GetPlayer();
+        if (!player)
+            return false;
 
-            reagents.push_back({ reagentEntry, reagentCount, playerHas, vaultHas, maxStack });
-        }
+        sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), skillId, 0, ABYSSAL_TRACE_CMD_CRAFTABLE);
+        sAbyssalStorageMgr->SendCraftableCounts(player, skillId);
+        return true;
+    }
 
-        // Count free bag slots
-        uint32 freeSlots = 0;
-        for (uint8 slot = INVENTORY_SLOT_ITEM_START; slot < INVENTORY_SLOT_ITEM_END; ++slot)
-        {
-            if (!player->GetItemByPos(INVENTORY_SLOT_BAG_0, slot))
-                freeSlots++;
-        }
-        for (uint8 bag = INVENTORY_SLOT_BAG_START; bag < INVENTORY_SLOT_BAG_END; ++bag)
+    // .abs admin export <file> [all | accountId[,accountId...]]
+    static bool HandleExportCommand(ChatHandler* handler, std::string file, Optional<std::string> accountList)
+    {
+        std::vector<uint32> accountIds;
+        if (accountList && *accountList != "all")
         {
-            if (Bag* pBag = player->GetBagByPos(bag))
+            for (std::string_view token : Acore::Tokenize(*accountList, ',', false))
             {
-                for (uint8 slot = 0; slot < pBag->GetBagSize(); ++slot)
+                Optional<uint32> accountId = Acore::StringTo<uint32>(token);
+                if (!accountId)
                 {
-                    if (!pBag->GetItemByPos(slot))
-                        freeSlots++;
+                    handler->PSendSysMessage("Abyssal Storage: Invalid account id '{}'.", token);
+                    handler->SetSentErrorMessage(true);
+                    return false;
                 }
+                accountIds.push_back(*accountId);
             }
         }
 
-        // Count how many distinct reagents need vault withdrawal
-        uint32 vaultReagentSlots = 0;
-        for (auto const& r : reagents)
+        AbyssalTransferStats stats;
+        std::string error;
+        if (!sAbyssalStorageMgr->ExportVaults(file, accountIds, stats, error))
         {
-            if (r.playerHas < r.perCraft)
-                vaultReagentSlots++;
+            handler->PSendSysMessage("Abyssal Storage: Export failed: {}.", error);
+            handler->SetSentErrorMessage(true);
+            return false;
         }
 
-        // Need: 1 slot per vault reagent type + 1 for the crafted product
-        if (freeSlots < vaultReagentSlots + 1)
+        handler->PSendSysMessage("Abyssal Storage: Exported {} rows ({} accounts) in {} ms ({} rows/s).",
+            stats.rows, stats.accounts, stats.elapsedMs, stats.rows * 1000 / std::max<uint32>(stats.elapsedMs, 1));
+        return true;
+    }
+
+    // .abs admin import <file> [merge | replace]
+    static bool HandleImportCommand(ChatHandler* handler, std::string file, Optional<std::string> mode)
+    {
+        bool replace = false;
+        if (mode)
         {
-            handler->SendSysMessage("Abyssal Storage: Not enough bag space (need room for reagents + product).");
-            return true;
+            if (*mode == "replace")
+                replace = true;
+            else if (*mode != "merge")
+            {
+                handler->SendSysMessage("Abyssal Storage: Import mode must be 'merge' or 'replace'.");
+                handler->SetSentErrorMessage(true);
+                return false;
+            }
         }
 
-        // Cap craft count by total available reagents (inventory + vault)
-        uint32 maxCrafts = craftCount;
-        for (auto const& r : reagents)
+        AbyssalTransferStats stats;
+        std::string error;
+        if (!sAbyssalStorageMgr->ImportVaults(file, replace, stats, error))
         {
-            uint32 possible = (r.playerHas + r.vaultHas) / r.perCraft;
-            maxCrafts = std::min(maxCrafts, possible);
+            handler->PSendSysMessage("Abyssal Storage: Import failed: {}. Nothing was written.", error);
+            handler->SetSentErrorMessage(true);
+            return false;
         }
 
-        // Cap further: each vault reagent gets at most 1 max-stack of bag space,
-        // so the amount we can withdraw is limited
-        for (auto const& r : reagents)
-        {
-            if (r.playerHas >= r.perCraft * maxCrafts)
-                continue; // inventory alone covers this reagent for maxCrafts
+        handler->PSendSysMessage("Abyssal Storage: Imported {} rows ({} accounts, {}) in {} ms ({} rows/s).",
+            stats.rows, stats.accounts, replace ? "replace" : "merge", stats.elapsedMs, stats.rows * 1000 / std::max<uint32>(stats.elapsedMs, 1));
+        return true;
+    }
 
-            // Available in bags = what player already has + up to 1 max stack from vault
-            uint32 availableInBags = r.playerHas + std::min(r.vaultHas, r.maxStack);
-            uint32 possible = availableInBags / r.perCraft;
-            maxCrafts = std::min(maxCrafts, possible);
-        }
+    // .abs admin top [n]
+    // Largest realm-wide vault totals, from the in-memory aggregates
+    static bool HandleTopCommand(ChatHandler* handler, Optional<uint32> optCount)
+    {
+        uint32 count = std::clamp<uint32>(optCount.value_or(10), 1, 100);
 
-        if (maxCrafts == 0)
+        std::vector<std::pair<uint32, uint64>> top = sAbyssalStorageMgr->GetTopRealmTotals(count);
+        if (top.empty())
         {
-            handler->SendSysMessage("Abyssal Storage: Not enough reagents.");
+            handler->SendSysMessage("Abyssal Storage: No items stored realm-wide.");
             return true;
         }
 
-        craftCount = std::min(craftCount, maxCrafts);
+        handler->PSendSysMessage("Abyssal Storage: Top {} items stored realm-wide:", top.size());
+        for (std::size_t i = 0; i < top.size(); ++i)
+            handler->PSendSysMessage("  {}. {} x{}", i + 1, BuildItemLink(top[i].first), top[i].second);
+        return true;
+    }
 
-        AbyssalPlayerData* data = GetAbyssalData(player);
-        if (data)
-            data->isMaterializing = true;
+    // .abs admin rebuildtotals
+    // Recounts abyssal_storage_totals from abyssal_storage (one full table scan)
+    static bool HandleRebuildTotalsCommand(ChatHandler* handler)
+    {
+        sAbyssalStorageMgr->RebuildRealmTotals();
+        handler->SendSysMessage("Abyssal Storage: Realm totals rebuild queued.");
+        return true;
+    }
 
-        // Materialize reagents needed for craftCount crafts (at most 1 stack per type)
-        for (auto const& r : reagents)
+    // .abs admin stats
+    // Runtime counters of the storage caches
+    static bool HandleStatsCommand(ChatHandler* handler)
+    {
+        uint64 hits, misses;
+        uint32 cachedAccounts;
+        sAbyssalStorageMgr->GetSyncCacheStats(hits, misses, cachedAccounts);
+
+        handler->SendSysMessage("Abyssal Storage: Cache statistics");
+        handler->PSendSysMessage("  SYNC cache: {} hits, {} misses ({}% hit rate), {} accounts cached",
+            hits, misses, hits * 100 / std::max<uint64>(hits + misses, 1), cachedAccounts);
+
+        AbyssalSchedulerStats scheduler;
+        sAbyssalStorageMgr->GetSchedulerStats(scheduler);
+        handler->PSendSysMessage("  Scheduler: {} critical, {} deposit, {} sync queued (max {}), {} run",
+            scheduler.queued[ABYSSAL_WORK_CRITICAL], scheduler.queued[ABYSSAL_WORK_DEPOSIT], scheduler.queued[ABYSSAL_WORK_SYNC],
+            scheduler.maxQueued, scheduler.executed);
+        handler->PSendSysMessage("  Tick budget: {} us, last tick {} us, {} ticks carried work over, {} overran",
+            scheduler.budgetUs, scheduler.lastTickUs, scheduler.carried, scheduler.overruns);
+
+        uint64 prefetches, abandoned;
+        uint32 sessionAccounts;
+        sAbyssalStorageMgr->GetPrefetchStats(prefetches, abandoned, sessionAccounts);
+        handler->PSendSysMessage("  Prefetch: {} issued at account login, {} abandoned, {} accounts held by sessions",
+            prefetches, abandoned, sessionAccounts);
+        return true;
+    }
+
+    // .abs admin replay <file> [fast | realtime]
+    // Replays a recorded hook trace in the background; results go to the log
+    static bool HandleReplayCommand(ChatHandler* handler, std::string file, Optional<std::string> mode)
+    {
+        bool realtime = mode && *mode == "realtime";
+        if (mode && !realtime && *mode != "fast")
         {
-            uint32 totalNeeded = r.perCraft * craftCount;
-            if (r.playerHas >= totalNeeded)
-                continue;
+            handler->SendSysMessage("Abyssal Storage: Replay mode must be 'fast' or 'realtime'.");
+            handler->SetSentErrorMessage(true);
+            return false;
+        }
 
-            uint32 deficit = totalNeeded - r.playerHas;
-            uint32 toWithdraw = std::min(deficit, r.vaultHas);
-            if (toWithdraw == 0)
-                continue;
+        std::string error;
+        if (!StartAbyssalTraceReplay(file, realtime, error))
+        {
+            handler->PSendSysMessage("Abyssal Storage: Replay failed: {}.", error);
+            handler->SetSentErrorMessage(true);
+            return false;
+        }
 
-            ItemPosCountVec dest;
-            InventoryResult invResult = player->CanStoreNewItem(NULL_BAG, NULL_SLOT, dest, r.entry, toWithdraw);
-            if (invResult != EQUIP_ERR_OK)
-            {
-                if (data)
-                    data->isMaterializing = false;
-                handler->SendSysMessage("Abyssal Storage: Not enough bag space for reagents.");
-                return true;
-            }
+        handler->PSendSysMessage("Abyssal Storage: Replaying {} ({}); throughput and latency will be logged when it ends.", file, realtime ? "realtime" : "fast");
+        handler->SendSysMessage("Abyssal Storage: Replay runs inside this worldserver and shares its storage lock and CPU with live players; numbers taken under load aren't comparable.");
+        return true;
+    }
 
-            Item* newItem = player->StoreNewItem(dest, r.entry, true);
-            if (newItem && data)
-                data->materializedItems.insert(newItem->GetGUID().GetCounter());
+    // .abs craft <spellId> [count]
+    // Materializes reagents from vault and casts the crafting spell
+    static bool HandleCraftCommand(ChatHandler* handler, uint32 spellId, Optional<uint32> optCount)
+    {
+        if (!sAbyssalStorageMgr->IsEnabled())
+            return false;
 
-            sAbyssalStorageMgr->WithdrawItem(accountId, r.entry, toWithdraw);
-            sAbyssalStorageMgr->SendItemUpdate(player, r.entry, sAbyssalStorageMgr->GetItemCount(accountId, r.entry));
-        }
+        Player* player = handler->GetSession()->GetPlayer();
+        if (!player)
+            return false;
 
-        if (data)
-        {
-            data->isMaterializing = false;
-            data->autoStoreEnabled = false; // prevent re-deposit of withdrawn reagents
-            data->pendingCrafts = craftCount;  // OnSpellCast will decrement and re-cast
-            data->pendingSpellId = spellId;
-        }
+        sAbyssalTrace->Record(ABYSSAL_TRACE_COMMAND, player->GetSession()->GetAccountId(), spellId, optCount.value_or(1), ABYSSAL_TRACE_CMD_CRAFT);
 
-        // Cast once — OnSpellCast will chain the remaining crafts
-        player->CastSpell(player, spellId, false);
+        uint32 crafts = 0;
+        AbyssalResult result = sAbyssalStorageMgr->StartCraft(player, spellId, optCount.value_or(1), crafts);
+        if (result == ABYSSAL_ERR_BAG_FULL)
+            handler->SendSysMessage("Abyssal Storage: Not enough bag space (need room for reagents + product).");
+        else if (result != ABYSSAL_OK)
+            handler->SendSysMessage(GetResultText(result));
 
         return true;
     }
@@ -739,6 +833,7 @@ public:
 void AddSC_abyssal_storage_scripts()
 {
     new AbyssalStorageWorldScript();
+    new AbyssalStorageAccountScript();
     new AbyssalStoragePlayerScript();
     new AbyssalStorageSpellScript();
     new AbyssalStorageCommandScript();
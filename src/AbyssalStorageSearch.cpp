@@ -0,0 +1,216 @@
+#include "AbyssalStorage.h"
+#include "ItemTemplate.h"
+#include "Log.h"
+#include "ObjectMgr.h"
+#include "Player.h"
+#include "Timer.h"
+#include "Util.h"
+#include "WorldSession.h"
+#include <iterator>
+#include <tuple>
+
+// ============================================================================
+// Name search
+// ============================================================================
+//
+// The addon can only search names the client has cached, so uncached items are
+// unfindable there. The server searches instead: every storable template's name
+// (and its localized names) is lowercased into a slot, and each three-byte run of
+// a slot's name maps to the ascending list of slots containing it. A query
+// intersects the lists of its own trigrams, confirms the substring on the few
+// candidates left and keeps the entries the vault holds. Queries shorter than a
+// trigram scan the slots directly.
+
+static constexpr uint32 MAX_SEARCH_RESULTS = 50;
+
+static std::string ToSearchKey(std::string_view name)
+{
+    std::wstring wname;
+    if (!Utf8toWStr(name, wname))
+        return {};
+
+    wstrToLower(wname);
+
+    std::string key;
+    WStrToUtf8(wname, key);
+    return key;
+}
+
+static uint32 PackTrigram(std::string_view key, std::size_t pos)
+{
+    return (uint32(uint8(key[pos])) << 16) | (uint32(uint8(key[pos + 1])) << 8) | uint32(uint8(key[pos + 2]));
+}
+
+void AbyssalStorageMgr::BuildNameIndex()
+{
+    uint32 startTime = getMSTime();
+
+    AbyssalNameIndex index;
+    auto addName = [&index](uint32 entry, std::string const& name)
+    {
+        std::string key = ToSearchKey(name);
+        if (key.empty())
+            return;
+
+        uint32 slot = index.entries.size();
+        index.entries.push_back(entry);
+
+        for (std::size_t pos = 0; pos + 3 <= key.size(); ++pos)
+        {
+            std::vector<uint32>& slots = index.trigrams[PackTrigram(key, pos)];
+            // A name repeating a trigram would list its slot twice
+            if (slots.empty() || slots.back() != slot)
+                slots.push_back(slot);
+        }
+
+        index.names.push_back(std::move(key));
+    };
+
+    // Same classes ShouldAutoStore accepts; nothing else reaches a vault
+    for (auto const& [entry, proto] : *sObjectMgr->GetItemTemplateStore())
+    {
+        if (proto.Class != ITEM_CLASS_TRADE_GOODS && proto.Class != ITEM_CLASS_GEM)
+            continue;
+
+        addName(entry, proto.Name1);
+
+        if (ItemLocale const* locale = sObjectMgr->GetItemLocale(entry))
+        {
+            for (std::string const& name : locale->Name)
+            {
+                if (!name.empty() && name != proto.Name1)
+                    addName(entry, name);
+            }
+        }
+    }
+
+    _nameIndex = std::move(index);
+
+    LOG_INFO("server.loading", ">> Indexed {} abyssal storage item names ({} trigrams) in {} ms",
+        _nameIndex.names.size(), _nameIndex.trigrams.size(), GetMSTimeDiffToNow(startTime));
+}
+
+uint32 AbyssalStorageMgr::SearchVault(uint32 accountId, std::string_view query, uint32 limit, std::vector<std::pair<uint32, uint32>>& results)
+{
+    results.clear();
+
+    std::string key = ToSearchKey(query);
+    if (key.empty())
+        return 0;
+
+    // Candidate slots: every slot for short queries, else the intersection of the trigram lists
+    std::vector<uint32> candidates;
+    if (key.size() < 3)
+    {
+        candidates.resize(_nameIndex.names.size());
+        for (uint32 slot = 0; slot < candidates.size(); ++slot)
+            candidates[slot] = slot;
+    }
+    else
+    {
+        std::vector<std::vector<uint32> const*> lists;
+        for (std::size_t pos = 0; pos + 3 <= key.size(); ++pos)
+        {
+            auto itr = _nameIndex.trigrams.find(PackTrigram(key, pos));
+            if (itr == _nameIndex.trigrams.end())
+                return 0;
+            lists.push_back(&itr->second);
+        }
+
+        // Smallest first keeps every intersection at most that size
+        std::sort(lists.begin(), lists.end(), [](auto const* a, auto const* b) { return a->size() < b->size(); });
+
+        candidates = *lists.front();
+        std::vector<uint32> narrowed;
+        for (std::size_t i = 1; i < lists.size() && !candidates.empty(); ++i)
+        {
+            narrowed.clear();
+            std::set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(narrowed));
+            candidates.swap(narrowed);
+        }
+    }
+
+    std::vector<uint32> matches;
+    for (uint32 slot : candidates)
+    {
+        if (_nameIndex.names[slot].find(key) != std::string::npos)
+            matches.push_back(_nameIndex.entries[slot]);
+    }
+
+    // An entry matching in several locales has several slots
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
+    // Keep what the vault holds; lazily loaded accounts know every entry without its row
+    {
+        std::lock_guard<std::mutex> lock(_storageMutex);
+
+        auto accIt = _storage.find(accountId);
+        if (accIt == _storage.end())
+            return 0;
+
+        auto resIt = _residency.find(accountId);
+        std::erase_if(matches, [&](uint32 entry)
+        {
+            return resIt != _residency.end() ? !resIt->second.known.contains(entry) : !accIt->second.contains(entry);
+        });
+    }
+
+    std::vector<ItemTemplate const*> ordered;
+    ordered.reserve(matches.size());
+    for (uint32 entry : matches)
+    {
+        if (ItemTemplate const* proto = sObjectMgr->GetItemTemplate(entry))
+            ordered.push_back(proto);
+    }
+
+    uint32 total = ordered.size();
+    limit = std::min({ limit, MAX_SEARCH_RESULTS, total });
+    std::partial_sort(ordered.begin(), ordered.begin() + limit, ordered.end(), [](ItemTemplate const* a, ItemTemplate const* b)
+    {
+        return std::tie(a->Name1, a->ItemId) < std::tie(b->Name1, b->ItemId);
+    });
+    ordered.resize(limit);
+
+    std::vector<uint32> entries;
+    entries.reserve(ordered.size());
+    for (ItemTemplate const* proto : ordered)
+        entries.push_back(proto->ItemId);
+    EnsureResident(accountId, entries);
+
+    results.reserve(entries.size());
+    for (uint32 entry : entries)
+        results.emplace_back(entry, GetItemCount(accountId, entry));
+
+    return total;
+}
+
+// FIND:entry,count,name;... — names in the client's locale, last so they may hold commas.
+// May span several packets; the request's ACK (carrying the match count) marks the end
+uint32 AbyssalStorageMgr::SendSearchResults(Player* player, std::string_view query, uint32 limit)
+{
+    std::vector<std::pair<uint32, uint32>> results;
+    uint32 total = SearchVault(player->GetSession()->GetAccountId(), query, limit, results);
+
+    LocaleConstant localeIndex = player->GetSession()->GetSessionDbLocaleIndex();
+
+    std::string msg = "FIND:";
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+        auto [entry, count] = results[i];
+
+        std::string name = sObjectMgr->GetItemTemplate(entry)->Name1;
+        if (ItemLocale const* locale = sObjectMgr->GetItemLocale(entry))
+            ObjectMgr::GetLocaleString(locale->Name, localeIndex, name);
+
+        // ';' separates rows
+        std::replace(name.begin(), name.end(), ';', ',');
+
+        if (i)
+            msg += ";";
+        msg += std::to_string(entry) + "," + std::to_string(count) + "," + name;
+    }
+
+    SendAddonMessage(player, msg);
+    return total;
+}
@@ -0,0 +1,213 @@
+#include "AbyssalStorage.h"
+#include "DatabaseEnv.h"
+#include "Log.h"
+#include "Timer.h"
+
+// ============================================================================
+// Realm-wide totals
+// ============================================================================
+//
+// abyssal_storage_totals holds SUM(count) per item so the economy team never has
+// to scan abyssal_storage. Every deposit/withdrawal adds its delta to the cached
+// total and to a pending map. The pending map is flushed as a single relative upsert
+// every FlushInterval, so worldservers sharing the DB each add only their own
+// deltas. Only one totals write is in flight at a time; after it commits the cache
+// is re-read from the table (picking up other nodes' deltas), with whatever is
+// still pending added back on top. A failed write puts its deltas back into the
+// pending map, and shutdown writes what is left synchronously.
+
+static constexpr std::size_t TOTALS_FLUSH_BATCH = 500;
+
+void AbyssalStorageMgr::SetTotalsFlushInterval(uint32 seconds)
+{
+    _totalsFlushInterval = std::max<uint32>(seconds, 1) * 1000;
+}
+
+void AbyssalStorageMgr::LoadRealmTotals()
+{
+    uint32 startTime = getMSTime();
+
+    std::unordered_map<uint32, int64> totals;
+    if (QueryResult result = CharacterDatabase.Query("SELECT item_entry, total FROM abyssal_storage_totals"))
+    {
+        do
+        {
+            Field* fields = result->Fetch();
+            totals[fields[0].Get<uint32>()] = fields[1].Get<int64>();
+        } while (result->NextRow());
+    }
+
+    std::lock_guard<std::mutex> lock(_totalsMutex);
+    for (auto const& [entry, delta] : _realmTotalDeltas)
+        totals[entry] += delta;
+    _realmTotals = std::move(totals);
+
+    LOG_INFO("server.loading", ">> Loaded {} abyssal storage item totals in {} ms", _realmTotals.size(), GetMSTimeDiffToNow(startTime));
+}
+
+void AbyssalStorageMgr::AddRealmDelta(uint32 itemEntry, int64 delta)
+{
+    std::lock_guard<std::mutex> lock(_totalsMutex);
+    _realmTotals[itemEntry] += delta;
+    _realmTotalDeltas[itemEntry] += delta;
+}
+
+uint64 AbyssalStorageMgr::GetRealmTotal(uint32 itemEntry)
+{
+    std::lock_guard<std::mutex> lock(_totalsMutex);
+    auto itr = _realmTotals.find(itemEntry);
+    return itr != _realmTotals.end() && itr->second > 0 ? uint64(itr->second) : 0;
+}
+
+std::vector<std::pair<uint32, uint64>> AbyssalStorageMgr::GetTopRealmTotals(uint32 limit)
+{
+    std::vector<std::pair<uint32, uint64>> top;
+    {
+        std::lock_guard<std::mutex> lock(_totalsMutex);
+        top.reserve(_realmTotals.size());
+        for (auto const& [entry, total] : _realmTotals)
+        {
+            if (total > 0)
+                top.emplace_back(entry, uint64(total));
+        }
+    }
+
+    limit = std::min<uint32>(limit, top.size());
+    std::partial_sort(top.begin(), top.begin() + limit, top.end(), [](auto const& a, auto const& b)
+    {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    top.resize(limit);
+    return top;
+}
+
+void AbyssalStorageMgr::FlushRealmTotals(bool synchronous)
+{
+    std::unordered_map<uint32, int64> deltas;
+    {
+        std::lock_guard<std::mutex> lock(_totalsMutex);
+        for (auto const& [entry, delta] : _realmTotalDeltas)
+        {
+            if (delta)
+                deltas.emplace(entry, delta);
+        }
+        _realmTotalDeltas.clear();
+    }
+
+    if (deltas.empty())
+        return;
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+    std::string values;
+    std::size_t rows = 0;
+    for (auto const& [entry, delta] : deltas)
+    {
+        if (rows)
+            values += ",";
+        values += "(" + std::to_string(entry) + "," + std::to_string(delta) + ")";
+
+        if (++rows == TOTALS_FLUSH_BATCH)
+        {
+            trans->Append("INSERT INTO abyssal_storage_totals (item_entry, total) VALUES {} "
+                "ON DUPLICATE KEY UPDATE total = total + VALUES(total)", values);
+            values.clear();
+            rows = 0;
+        }
+    }
+
+    if (rows)
+        trans->Append("INSERT INTO abyssal_storage_totals (item_entry, total) VALUES {} "
+            "ON DUPLICATE KEY UPDATE total = total + VALUES(total)", values);
+
+    if (synchronous)
+    {
+        CharacterDatabase.DirectCommitTransaction(trans);
+        return;
+    }
+
+    _totalsWriteInFlight = true;
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this, deltas = std::move(deltas)](bool success)
+    {
+        if (!success)
+        {
+            LOG_ERROR("module", "AbyssalStorage: realm totals flush failed, retrying {} items with the next one", deltas.size());
+
+            std::lock_guard<std::mutex> lock(_totalsMutex);
+            for (auto const& [entry, delta] : deltas)
+                _realmTotalDeltas[entry] += delta;
+            _totalsWriteInFlight = false;
+            return;
+        }
+
+        ReloadRealmTotals();
+    }));
+}
+
+void AbyssalStorageMgr::SaveRealmTotals()
+{
+    FlushRealmTotals(true);
+}
+
+void AbyssalStorageMgr::RebuildRealmTotals()
+{
+    _totalsRebuildPending = true;
+}
+
+// The rebuild drops the pending deltas because the scan already counts their rows.
+// That holds because:
+// - It only starts once no totals write is in flight (Update), so a delta flush
+//   can't commit after the scan, nor put failed deltas back on top of it.
+// - Every delta is added in the same call that queues its row write, and those
+//   calls never run alongside the world tick that starts the rebuild. Each row
+//   write dropped here is therefore queued before the rebuild.
+// - The character DB's async queue runs in order with its default single worker,
+//   and coherent mode commits deposits synchronously. With more async workers a
+//   rebuild may still miss a row written in the same tick.
+void AbyssalStorageMgr::WriteRebuiltRealmTotals()
+{
+    _totalsRebuildPending = false;
+    {
+        std::lock_guard<std::mutex> lock(_totalsMutex);
+        _realmTotalDeltas.clear();
+    }
+
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+    trans->Append("DELETE FROM abyssal_storage_totals");
+    trans->Append("INSERT INTO abyssal_storage_totals (item_entry, total) "
+        "SELECT item_entry, SUM(count) FROM abyssal_storage WHERE count > 0 GROUP BY item_entry");
+
+    _totalsWriteInFlight = true;
+    _transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(trans).AfterComplete([this](bool success)
+    {
+        if (success)
+            LOG_INFO("module", "AbyssalStorage: realm totals rebuilt");
+        else
+            LOG_ERROR("module", "AbyssalStorage: realm totals rebuild failed");
+
+        ReloadRealmTotals();
+    }));
+}
+
+void AbyssalStorageMgr::ReloadRealmTotals()
+{
+    _queryProcessor.AddCallback(CharacterDatabase.AsyncQuery("SELECT item_entry, total FROM abyssal_storage_totals")
+        .WithCallback([this](QueryResult result)
+    {
+        std::unordered_map<uint32, int64> totals;
+        if (result)
+        {
+            do
+            {
+                Field* fields = result->Fetch();
+                totals[fields[0].Get<uint32>()] = fields[1].Get<int64>();
+            } while (result->NextRow());
+        }
+
+        std::lock_guard<std::mutex> lock(_totalsMutex);
+        for (auto const& [entry, delta] : _realmTotalDeltas)
+            totals[entry] += delta;
+        _realmTotals = std::move(totals);
+        _totalsWriteInFlight = false;
+    }));
+}
@@ -0,0 +1,411 @@
+#include "AbyssalStorageTrace.h"
+#include "AbyssalStorage.h"
+#include "DatabaseEnv.h"
+#include "GameTime.h"
+#include "Log.h"
+#include "ObjectMgr.h"
+#include "QuestDef.h"
+#include "SpellInfo.h"
+#include "SpellMgr.h"
+#include "Timer.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+
+// ============================================================================
+// Trace recording
+// ============================================================================
+//
+// With AbyssalStorage.Trace.Enable the hooks append one fixed-size record per
+// invocation (login, logout, auto-store, reagent casts, quest turn-ins, player
+// commands) to a buffer that is written out in blocks. A trace of real traffic can
+// then be replayed on any build with .abs admin replay to compare how the vault
+// code performs under exactly the same load.
+
+static constexpr char TRACE_MAGIC[4] = { 'A', 'B', 'Y', 'T' };
+static constexpr uint32 TRACE_VERSION = 1;
+static constexpr std::size_t TRACE_BUFFER_RECORDS = 4096;
+static constexpr uint32 TRACE_FLUSH_INTERVAL = 5 * 1000;
+
+AbyssalTraceRecorder* AbyssalTraceRecorder::instance()
+{
+    static AbyssalTraceRecorder instance;
+    return &instance;
+}
+
+bool AbyssalTraceRecorder::Start(std::string const& path, std::string& error)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_recording)
+    {
+        error = "already recording to " + _path;
+        return false;
+    }
+
+    _out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!_out)
+    {
+        error = "cannot open " + path + " for writing";
+        return false;
+    }
+
+    uint64 startedAt = uint64(GameTime::GetGameTime().count());
+    _out.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    _out.write(reinterpret_cast<char const*>(&TRACE_VERSION), sizeof(TRACE_VERSION));
+    _out.write(reinterpret_cast<char const*>(&startedAt), sizeof(startedAt));
+
+    _path = path;
+    _buffer.reserve(TRACE_BUFFER_RECORDS);
+    _startTime = getMSTime();
+    _flushTimer = 0;
+    _recording = true;
+
+    LOG_INFO("module", "AbyssalStorage: recording hook trace to {}", path);
+    return true;
+}
+
+void AbyssalTraceRecorder::Stop()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_recording)
+        return;
+
+    _recording = false;
+    FlushBuffer();
+    _out.close();
+
+    LOG_INFO("module", "AbyssalStorage: hook trace {} closed", _path);
+}
+
+void AbyssalTraceRecorder::Append(AbyssalTraceEvent event, uint32 accountId, uint32 arg0, uint32 arg1, uint8 command)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_recording) // stopped since the caller checked
+        return;
+
+    _buffer.push_back({ GetMSTimeDiffToNow(_startTime), accountId, arg0, arg1, event, command, 0 });
+    if (_buffer.size() >= TRACE_BUFFER_RECORDS)
+        FlushBuffer();
+}
+
+void AbyssalTraceRecorder::FlushBuffer()
+{
+    if (_buffer.empty())
+        return;
+
+    _out.write(reinterpret_cast<char const*>(_buffer.data()), std::streamsize(_buffer.size() * sizeof(AbyssalTraceRecord)));
+    _out.flush();
+    _buffer.clear();
+
+    if (!_out)
+    {
+        LOG_ERROR("module", "AbyssalStorage: writing hook trace {} failed, recording stopped", _path);
+        _recording = false;
+        _out.close();
+    }
+}
+
+void AbyssalTraceRecorder::Update(uint32 diff)
+{
+    if (!IsRecording())
+        return;
+
+    _flushTimer += diff;
+    if (_flushTimer < TRACE_FLUSH_INTERVAL)
+        return;
+    _flushTimer = 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    FlushBuffer();
+}
+
+// ============================================================================
+// Replay
+// ============================================================================
+//
+// Each record is turned back into the vault operations its hook performs. Vaults
+// start from the traced accounts' current rows (read once) and live in the replay
+// namespace, so a replay never writes to the database and never touches a real
+// player's cache. What a hook decides from the live player (bag contents, known
+// recipes, mail) isn't in the trace: reagents and quest items are drawn as if the
+// bags were empty, and deposit-all, mail and craftable-count commands are skipped.
+// Replay vaults stay loaded until the replay ends. A traced logout doesn't drop
+// them, since a reload would come back empty instead of from the account's rows.
+//
+// Replay runs inside the live worldserver and contends with it for the storage
+// lock and CPU. It issues no queries of its own after the seed read, but the
+// live traffic around it does, so only runs on an idle server are comparable.
+
+static std::atomic<bool> sReplayRunning{ false };
+// The replay thread is joined at shutdown, or when the next replay starts
+static std::thread sReplayThread;
+static std::mutex sReplayMutex;
+static std::condition_variable sReplayWake;
+static bool sReplayStop = false; // guarded by sReplayMutex
+
+// Takes times x every reagent when the vault covers all of them, like a cast from empty bags
+static void ReplayReagents(uint32 accountId, SpellInfo const* spellInfo, uint32 times)
+{
+    for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+    {
+        if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0 &&
+            sAbyssalStorageMgr->GetItemCount(accountId, spellInfo->Reagent[i]) < spellInfo->ReagentCount[i] * times)
+            return;
+    }
+
+    for (uint8 i = 0; i < MAX_SPELL_REAGENTS; ++i)
+    {
+        if (spellInfo->Reagent[i] > 0 && spellInfo->ReagentCount[i] > 0)
+            sAbyssalStorageMgr->WithdrawItem(accountId, spellInfo->Reagent[i], spellInfo->ReagentCount[i] * times);
+    }
+}
+
+// Returns false for records that can't be replayed without a live player
+static bool ReplayRecord(AbyssalTraceRecord const& record, uint32 accountId)
+{
+    switch (record.event)
+    {
+        case ABYSSAL_TRACE_LOGIN:
+            // LoadAccountData already ran; the login SYNC reads the whole vault
+            sAbyssalStorageMgr->GetAllItems(accountId);
+            return true;
+        case ABYSSAL_TRACE_LOGOUT:
+            // The vault stays resident (see above); what a logout costs is the save,
+            // and replay accounts have nothing to save
+            return true;
+        case ABYSSAL_TRACE_STORE_ITEM:
+            // No transaction: replay accounts never write one
+            sAbyssalStorageMgr->DepositItem(accountId, record.arg0, record.arg1, nullptr);
+            return true;
+        case ABYSSAL_TRACE_SPELL_CHECK:
+            if (SpellInfo const* spellInfo = sSpellMgr->GetSpellInfo(record.arg0))
+                ReplayReagents(accountId, spellInfo, 1);
+            return true;
+        case ABYSSAL_TRACE_QUEST_COMPLETE:
+        {
+            Quest const* quest = sObjectMgr->GetQuestTemplate(record.arg0);
+            if (!quest)
+                return true;
+
+            for (uint8 i = 0; i < QUEST_ITEM_OBJECTIVES_COUNT; ++i)
+            {
+                uint32 reqItem = quest->RequiredItemId[i];
+                uint32 reqCount = quest->RequiredItemCount[i];
+                if (!reqItem || !reqCount)
+                    continue;
+
+                if (uint32 vaultCount = sAbyssalStorageMgr->GetItemCount(accountId, reqItem))
+                    sAbyssalStorageMgr->WithdrawItem(accountId, reqItem, std::min(reqCount, vaultCount));
+            }
+            return true;
+        }
+        case ABYSSAL_TRACE_COMMAND:
+            switch (record.command)
+            {
+                case ABYSSAL_TRACE_CMD_WITHDRAW:
+                {
+                    uint32 count = record.arg1 ? record.arg1 : sAbyssalStorageMgr->GetItemCount(accountId, record.arg0);
+                    if (count)
+                        sAbyssalStorageMgr->WithdrawItem(accountId, record.arg0, count);
+                    return true;
+                }
+                case ABYSSAL_TRACE_CMD_SYNC:
+                    sAbyssalStorageMgr->GetAllItems(accountId);
+                    return true;
+                case ABYSSAL_TRACE_CMD_CRAFT:
+                    if (SpellInfo const* spellInfo = sSpellMgr->GetSpellInfo(record.arg0))
+                        ReplayReagents(accountId, spellInfo, std::max<uint32>(record.arg1, 1));
+                    return true;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+static uint32 Percentile(std::vector<uint32>& values, uint32 percent)
+{
+    if (values.empty())
+        return 0;
+
+    auto nth = values.begin() + std::min<std::size_t>(values.size() * percent / 100, values.size() - 1);
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+static void RunReplay(std::string const& path, std::vector<AbyssalTraceRecord> const& records,
+    std::vector<std::tuple<uint32, uint32, uint32>> const& seed, bool realtime)
+{
+    std::unordered_set<uint32> accounts;
+    for (AbyssalTraceRecord const& record : records)
+        accounts.insert(record.accountId | ABYSSAL_REPLAY_ACCOUNT_FLAG);
+
+    for (uint32 accountId : accounts)
+        sAbyssalStorageMgr->LoadAccountData(accountId);
+    for (auto const& [accountId, itemEntry, count] : seed)
+        sAbyssalStorageMgr->DepositItem(accountId | ABYSSAL_REPLAY_ACCOUNT_FLAG, itemEntry, count, nullptr);
+
+    AbyssalReplayStats stats;
+    stats.accounts = accounts.size();
+
+    std::vector<uint32> latencies;
+    latencies.reserve(records.size());
+
+    bool stopped = false;
+    auto begin = std::chrono::steady_clock::now();
+    for (AbyssalTraceRecord const& record : records)
+    {
+        {
+            std::unique_lock<std::mutex> lock(sReplayMutex);
+            if (realtime)
+                sReplayWake.wait_until(lock, begin + std::chrono::milliseconds(record.timeMs), []() { return sReplayStop; });
+            if (sReplayStop)
+            {
+                stopped = true;
+                break;
+            }
+        }
+
+        uint32 accountId = record.accountId | ABYSSAL_REPLAY_ACCOUNT_FLAG;
+        auto start = std::chrono::steady_clock::now();
+        bool applied = ReplayRecord(record, accountId);
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        ++stats.events;
+        if (applied)
+        {
+            ++stats.applied;
+            latencies.push_back(uint32(latency.count()));
+        }
+    }
+    stats.elapsedMs = uint32(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
+
+    for (uint32 accountId : accounts)
+        sAbyssalStorageMgr->UnloadAccountData(accountId);
+
+    stats.p50Us = Percentile(latencies, 50);
+    stats.p90Us = Percentile(latencies, 90);
+    stats.p99Us = Percentile(latencies, 99);
+    stats.maxUs = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+
+    if (stopped)
+        LOG_INFO("module", "AbyssalStorage: replay of {} stopped early", path);
+
+    LOG_INFO("module", "AbyssalStorage: replayed {} ({}): {} events ({} applied, {} accounts) in {} ms, {} events/s; "
+        "latency p50 {} us, p90 {} us, p99 {} us, max {} us",
+        path, realtime ? "realtime" : "fast", stats.events, stats.applied, stats.accounts, stats.elapsedMs,
+        stats.events * 1000 / std::max<uint32>(stats.elapsedMs, 1), stats.p50Us, stats.p90Us, stats.p99Us, stats.maxUs);
+}
+
+bool StartAbyssalTraceReplay(std::string const& path, bool realtime, std::string& error)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    uint32 version = 0;
+    uint64 startedAt = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&startedAt), sizeof(startedAt));
+    if (!in || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        error = "not an abyssal storage trace";
+        return false;
+    }
+
+    if (version != TRACE_VERSION)
+    {
+        error = "unsupported trace version " + std::to_string(version);
+        return false;
+    }
+
+    // A recording cut short by a crash may end in a partial record; it is dropped
+    std::vector<AbyssalTraceRecord> records;
+    AbyssalTraceRecord record;
+    while (in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+    {
+        if (record.event >= MAX_ABYSSAL_TRACE_EVENT)
+        {
+            error = "corrupt record " + std::to_string(records.size());
+            return false;
+        }
+        records.push_back(record);
+    }
+
+    if (records.empty())
+    {
+        error = "trace holds no records";
+        return false;
+    }
+
+    // Starting state: the traced accounts' vaults as they are now (read only)
+    std::unordered_set<uint32> traced;
+    std::string accountList;
+    for (AbyssalTraceRecord const& rec : records)
+    {
+        if (traced.insert(rec.accountId).second)
+        {
+            if (!accountList.empty())
+                accountList += ",";
+            accountList += std::to_string(rec.accountId);
+        }
+    }
+
+    std::vector<std::tuple<uint32, uint32, uint32>> seed;
+    if (QueryResult result = CharacterDatabase.Query("SELECT account_id, item_entry, count FROM abyssal_storage WHERE account_id IN ({}) AND count > 0", accountList))
+    {
+        do
+        {
+            Field* fields = result->Fetch();
+            seed.emplace_back(fields[0].Get<uint32>(), fields[1].Get<uint32>(), fields[2].Get<uint32>());
+        } while (result->NextRow());
+    }
+
+    bool expected = false;
+    if (!sReplayRunning.compare_exchange_strong(expected, true))
+    {
+        error = "a replay is already running";
+        return false;
+    }
+
+    LOG_INFO("module", "AbyssalStorage: replaying {} ({} records over {} s, {} accounts)",
+        path, records.size(), records.back().timeMs / 1000, traced.size());
+
+    // The previous replay has finished (sReplayRunning was false); reap its thread
+    if (sReplayThread.joinable())
+        sReplayThread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(sReplayMutex);
+        sReplayStop = false;
+    }
+
+    sReplayThread = std::thread([path, records = std::move(records), seed = std::move(seed), realtime]()
+    {
+        RunReplay(path, records, seed, realtime);
+        sReplayRunning = false;
+    });
+
+    return true;
+}
+
+void StopAbyssalTraceReplay()
+{
+    {
+        std::lock_guard<std::mutex> lock(sReplayMutex);
+        sReplayStop = true;
+    }
+    sReplayWake.notify_all();
+
+    if (sReplayThread.joinable())
+        sReplayThread.join();
+}
@@ -0,0 +1,105 @@
+#ifndef ABYSSAL_STORAGE_TRACE_H
+#define ABYSSAL_STORAGE_TRACE_H
+
+#include "Define.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Hook traffic recorded for offline replay (AbyssalStorageTrace.cpp)
+enum AbyssalTraceEvent : uint8
+{
+    ABYSSAL_TRACE_LOGIN = 0,
+    ABYSSAL_TRACE_LOGOUT,
+    ABYSSAL_TRACE_STORE_ITEM,     // arg0 = item entry, arg1 = count queued for auto-store
+    ABYSSAL_TRACE_SPELL_CHECK,    // arg0 = spell id of a cast with reagents
+    ABYSSAL_TRACE_QUEST_COMPLETE, // arg0 = quest id
+    ABYSSAL_TRACE_COMMAND,        // command = AbyssalTraceCommand, args as the command's
+    MAX_ABYSSAL_TRACE_EVENT
+};
+
+enum AbyssalTraceCommand : uint8
+{
+    ABYSSAL_TRACE_CMD_WITHDRAW = 0, // arg0 = item entry, arg1 = count (0 = all)
+    ABYSSAL_TRACE_CMD_DEPOSIT,
+    ABYSSAL_TRACE_CMD_SYNC,
+    ABYSSAL_TRACE_CMD_CRAFT,        // arg0 = spell id, arg1 = count
+    ABYSSAL_TRACE_CMD_MAIL,
+    ABYSSAL_TRACE_CMD_CRAFTABLE     // arg0 = skill line id
+};
+
+// On-disk record, written in host byte order after a 16-byte file header:
+// "ABYT", uint32 version, uint64 unix time the recording started
+struct AbyssalTraceRecord
+{
+    uint32 timeMs;    // since the recording started
+    uint32 accountId;
+    uint32 arg0;
+    uint32 arg1;
+    uint8 event;
+    uint8 command;
+    uint16 reserved;
+};
+
+static_assert(sizeof(AbyssalTraceRecord) == 20, "trace records are fixed-size on disk");
+
+class AbyssalTraceRecorder
+{
+public:
+    static AbyssalTraceRecorder* instance();
+
+    bool Start(std::string const& path, std::string& error);
+    void Stop();
+    bool IsRecording() const { return _recording.load(std::memory_order_relaxed); }
+
+    // A relaxed load when not recording; otherwise an append to the in-memory buffer
+    void Record(AbyssalTraceEvent event, uint32 accountId, uint32 arg0 = 0, uint32 arg1 = 0, uint8 command = 0)
+    {
+        if (IsRecording())
+            Append(event, accountId, arg0, arg1, command);
+    }
+
+    // World tick: writes buffered records out every few seconds
+    void Update(uint32 diff);
+
+private:
+    AbyssalTraceRecorder() = default;
+
+    void Append(AbyssalTraceEvent event, uint32 accountId, uint32 arg0, uint32 arg1, uint8 command);
+    // Caller holds _mutex
+    void FlushBuffer();
+
+    std::atomic<bool> _recording{ false };
+    std::mutex _mutex;
+    std::ofstream _out;
+    std::string _path;
+    std::vector<AbyssalTraceRecord> _buffer;
+    uint32 _startTime = 0;
+    uint32 _flushTimer = 0;
+};
+
+#define sAbyssalTrace AbyssalTraceRecorder::instance()
+
+struct AbyssalReplayStats
+{
+    uint64 events = 0;
+    uint64 applied = 0; // events that map onto vault operations; the rest need a live player
+    uint32 accounts = 0;
+    uint32 elapsedMs = 0;
+    uint32 p50Us = 0;
+    uint32 p90Us = 0;
+    uint32 p99Us = 0;
+    uint32 maxUs = 0;
+};
+
+// Replays a trace against AbyssalStorageMgr on a background thread, either as fast
+// as possible or at the recorded pace. Traced accounts are mapped into the replay
+// namespace (ABYSSAL_REPLAY_ACCOUNT_FLAG), whose vaults never touch the database.
+// Results are logged when the replay ends. Returns false if one is already running.
+bool StartAbyssalTraceReplay(std::string const& path, bool realtime, std::string& error);
+// Ends a running replay at the next record and waits for its thread; for shutdown
+void StopAbyssalTraceReplay();
+
+#endif // ABYSSAL_STORAGE_TRACE_H
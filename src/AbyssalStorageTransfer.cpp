@@ -0,0 +1,320 @@
+#include "AbyssalStorage.h"
+#include "DatabaseEnv.h"
+#include "Log.h"
+#include "ObjectMgr.h"
+#include "Player.h"
+#include "StringConvert.h"
+#include "Timer.h"
+#include "Tokenize.h"
+#include "World.h"
+#include "WorldSession.h"
+#include <fstream>
+#include <set>
+
+// ============================================================================
+// Snapshot format (CSV)
+// ============================================================================
+//
+//   # abyssal_storage v1
+//   account_id,item_entry,count
+//   1,2589,120
+//   ...
+//   # rows=<n> checksum=<fnv1a32 of every data line incl. '\n', hex>
+//
+// Rows are written sorted by (account_id, item_entry). Import rejects the whole
+// file if the footer is missing or doesn't match, so truncated copies are caught.
+
+static constexpr char const* SNAPSHOT_MAGIC = "# abyssal_storage v1";
+static constexpr char const* SNAPSHOT_HEADER = "account_id,item_entry,count";
+static constexpr std::size_t IMPORT_BATCH_ROWS = 500;
+
+static uint32 Fnv1a(uint32 hash, std::string_view data)
+{
+    for (char c : data)
+    {
+        hash ^= uint8(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static constexpr uint32 FNV_OFFSET_BASIS = 2166136261u;
+
+// The export/import commands are reachable by GM accounts, which must not get to
+// read or overwrite arbitrary files the worldserver can reach
+static bool GetSnapshotPath(std::string const& directory, std::string const& file, std::string& path, std::string& error)
+{
+    if (file.empty() || file == "." || file == ".." || file.find_first_of("/\\:") != std::string::npos)
+    {
+        error = "'" + file + "' is not a plain file name";
+        return false;
+    }
+
+    path = directory.empty() ? file : directory + "/" + file;
+    return true;
+}
+
+struct SnapshotRow
+{
+    uint32 accountId;
+    uint32 itemEntry;
+    uint32 count;
+};
+
+bool AbyssalStorageMgr::ExportVaults(std::string const& file, std::vector<uint32> const& accountIds, AbyssalTransferStats& stats, std::string& error)
+{
+    uint32 startTime = getMSTime();
+
+    std::string path;
+    if (!GetSnapshotPath(_snapshotDirectory, file, path, error))
+        return false;
+
+    // Coherent mode leaves zero-count rows behind; they carry no data
+    std::string where = " WHERE count > 0";
+    if (!accountIds.empty())
+    {
+        where += " AND account_id IN (";
+        for (std::size_t i = 0; i < accountIds.size(); ++i)
+        {
+            if (i)
+                where += ",";
+            where += std::to_string(accountIds[i]);
+        }
+        where += ")";
+    }
+
+    QueryResult result = CharacterDatabase.Query("SELECT account_id, item_entry, count FROM abyssal_storage{} ORDER BY account_id, item_entry", where);
+
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out)
+    {
+        error = "cannot open " + path + " for writing";
+        return false;
+    }
+
+    out << SNAPSHOT_MAGIC << '\n' << SNAPSHOT_HEADER << '\n';
+
+    uint32 checksum = FNV_OFFSET_BASIS;
+    uint32 lastAccount = 0;
+    if (result)
+    {
+        std::string line;
+        do
+        {
+            Field* fields = result->Fetch();
+            uint32 accountId = fields[0].Get<uint32>();
+
+            line = std::to_string(accountId) + "," + std::to_string(fields[1].Get<uint32>()) + "," + std::to_string(fields[2].Get<uint32>()) + "\n";
+            checksum = Fnv1a(checksum, line);
+            out << line;
+
+            if (!stats.rows || accountId != lastAccount)
+                ++stats.accounts;
+            lastAccount = accountId;
+            ++stats.rows;
+        } while (result->NextRow());
+    }
+
+    out << "# rows=" << stats.rows << " checksum=" << std::hex << checksum << std::dec << '\n';
+    out.close();
+
+    if (!out)
+    {
+        error = "write to " + path + " failed";
+        return false;
+    }
+
+    stats.elapsedMs = GetMSTimeDiffToNow(startTime);
+    LOG_INFO("module", "AbyssalStorage: exported {} rows ({} accounts) to {} in {} ms", stats.rows, stats.accounts, path, stats.elapsedMs);
+    return true;
+}
+
+bool AbyssalStorageMgr::ImportVaults(std::string const& file, bool replace, AbyssalTransferStats& stats, std::string& error)
+{
+    uint32 startTime = getMSTime();
+
+    std::string path;
+    if (!GetSnapshotPath(_snapshotDirectory, file, path, error))
+        return false;
+
+    std::ifstream in(path);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // Pass 1: parse and validate everything before touching the database
+    std::vector<SnapshotRow> rows;
+    std::set<std::pair<uint32, uint32>> seen;
+    std::set<uint32> accounts;
+    uint32 checksum = FNV_OFFSET_BASIS;
+    bool sawMagic = false;
+    bool sawHeader = false;
+    bool sawFooter = false;
+    uint64 footerRows = 0;
+    uint32 footerChecksum = 0;
+
+    std::string line;
+    uint32 lineNo = 0;
+    while (std::getline(in, line))
+    {
+        ++lineNo;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.empty())
+            continue;
+
+        if (sawFooter)
+        {
+            error = "data after footer at line " + std::to_string(lineNo);
+            return false;
+        }
+
+        if (line[0] == '#')
+        {
+            if (line == SNAPSHOT_MAGIC)
+                sawMagic = true;
+            else if (line.rfind("# rows=", 0) == 0)
+            {
+                std::vector<std::string_view> tokens = Acore::Tokenize(std::string_view(line).substr(2), ' ', false);
+                Optional<uint64> n = tokens.size() == 2 && tokens[0].substr(0, 5) == "rows=" ? Acore::StringTo<uint64>(tokens[0].substr(5)) : Optional<uint64>();
+                Optional<uint32> sum = tokens.size() == 2 && tokens[1].substr(0, 9) == "checksum=" ? Acore::StringTo<uint32>(tokens[1].substr(9), 16) : Optional<uint32>();
+                if (!n || !sum)
+                {
+                    error = "malformed footer at line " + std::to_string(lineNo);
+                    return false;
+                }
+                footerRows = *n;
+                footerChecksum = *sum;
+                sawFooter = true;
+            }
+            continue;
+        }
+
+        if (!sawHeader)
+        {
+            if (!sawMagic || line != SNAPSHOT_HEADER)
+            {
+                error = "not an abyssal_storage v1 snapshot";
+                return false;
+            }
+            sawHeader = true;
+            continue;
+        }
+
+        std::vector<std::string_view> fields = Acore::Tokenize(line, ',', true);
+        Optional<uint32> accountId = fields.size() == 3 ? Acore::StringTo<uint32>(fields[0]) : Optional<uint32>();
+        Optional<uint32> itemEntry = fields.size() == 3 ? Acore::StringTo<uint32>(fields[1]) : Optional<uint32>();
+        Optional<uint32> count = fields.size() == 3 ? Acore::StringTo<uint32>(fields[2]) : Optional<uint32>();
+        if (!accountId || !itemEntry || !count || !*count)
+        {
+            error = "malformed row at line " + std::to_string(lineNo);
+            return false;
+        }
+
+        if (!sObjectMgr->GetItemTemplate(*itemEntry))
+        {
+            error = "unknown item " + std::to_string(*itemEntry) + " at line " + std::to_string(lineNo);
+            return false;
+        }
+
+        if (!seen.emplace(*accountId, *itemEntry).second)
+        {
+            error = "duplicate row at line " + std::to_string(lineNo);
+            return false;
+        }
+
+        checksum = Fnv1a(checksum, line);
+        checksum = Fnv1a(checksum, "\n");
+        accounts.insert(*accountId);
+        rows.push_back({ *accountId, *itemEntry, *count });
+    }
+
+    if (!sawFooter)
+    {
+        error = "missing footer (truncated file?)";
+        return false;
+    }
+
+    if (footerRows != rows.size() || footerChecksum != checksum)
+    {
+        error = "footer mismatch: expected " + std::to_string(footerRows) + " rows, read " + std::to_string(rows.size()) + (footerChecksum != checksum ? ", checksum differs" : "");
+        return false;
+    }
+
+    // Pass 2: one transaction, multi-row statements. Rows are upserted rather than
+    // deleted and re-inserted so their versions keep increasing (see coherence)
+    CharacterDatabaseTransaction trans = CharacterDatabase.BeginTransaction();
+
+    std::string accountList;
+    for (uint32 accountId : accounts)
+    {
+        if (!accountList.empty())
+            accountList += ",";
+        accountList += std::to_string(accountId);
+    }
+
+    if (replace && !accounts.empty())
+        trans->Append("UPDATE abyssal_storage SET count = 0, version = version + 1 WHERE account_id IN ({})", accountList);
+
+    for (std::size_t begin = 0; begin < rows.size(); begin += IMPORT_BATCH_ROWS)
+    {
+        std::size_t end = std::min(rows.size(), begin + IMPORT_BATCH_ROWS);
+
+        std::string values;
+        values.reserve((end - begin) * 24);
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            if (i != begin)
+                values += ",";
+            values += "(" + std::to_string(rows[i].accountId) + "," + std::to_string(rows[i].itemEntry) + "," + std::to_string(rows[i].count) + ",1)";
+        }
+
+        if (replace)
+            trans->Append("INSERT INTO abyssal_storage (account_id, item_entry, count, version) VALUES {} "
+                "ON DUPLICATE KEY UPDATE count = VALUES(count)", values);
+        else
+            trans->Append("INSERT INTO abyssal_storage (account_id, item_entry, count, version) VALUES {} "
+                "ON DUPLICATE KEY UPDATE count = LEAST(count + VALUES(count), 4294967295), version = version + 1", values);
+    }
+
+    if (!accounts.empty())
+    {
+        // Coherent mode keeps zero rows so versions never restart; otherwise drop them
+        if (!IsCoherent())
+            trans->Append("DELETE FROM abyssal_storage WHERE account_id IN ({}) AND count = 0", accountList);
+        else // let other worldservers sharing this DB pick the new rows up
+            trans->Append("INSERT IGNORE INTO abyssal_storage_changes (account_id, item_entry, version, origin) "
+                "SELECT account_id, item_entry, version, {} FROM abyssal_storage WHERE account_id IN ({})", _nodeId, accountList);
+    }
+
+    // Blocking — cached accounts are reloaded from the rows we just wrote
+    CharacterDatabase.DirectCommitTransaction(trans);
+
+    for (uint32 accountId : accounts)
+        RefreshAccount(accountId);
+
+    // Replace imports can change any total, so recount rather than track deltas
+    RebuildRealmTotals();
+
+    stats.accounts = accounts.size();
+    stats.rows = rows.size();
+    stats.elapsedMs = GetMSTimeDiffToNow(startTime);
+    LOG_INFO("module", "AbyssalStorage: imported {} rows ({} accounts, {}) from {} in {} ms", stats.rows, stats.accounts, replace ? "replace" : "merge", path, stats.elapsedMs);
+    return true;
+}
+
+void AbyssalStorageMgr::RefreshAccount(uint32 accountId)
+{
+    if (!IsAccountLoaded(accountId))
+        return;
+
+    UnloadAccountData(accountId);
+    LoadAccountData(accountId);
+
+    WorldSession* session = sWorld->FindSession(accountId);
+    if (session && session->GetPlayer() && session->GetPlayer()->IsInWorld())
+        QueueFullSync(session->GetPlayer());
+}